@@ -27,6 +27,7 @@
     NSURL *selectedFileURL;
     NSURL *selectedUtilityURL;
     NSMenuItem *registerDeviceMenuItem;
+    NSMenuItem *archiveMenuItem;
     NSMenuItem *mailPluginMenuItem;
 }
 
@@ -60,7 +61,8 @@ static void handle_idevice_event(const idevice_event_t *event, void *user_data)
 - (void)viewDidLoad {
     [super viewDidLoad];
     [[NSUserDefaults standardUserDefaults] registerDefaults:@{
-        @"RegisterDeviceAutomatically": @(YES)
+        @"RegisterDeviceAutomatically": @(YES),
+        @"InstallAppsAsArchives": @(NO)
     }];
     
     NSMenuItem *item = NSApp.mainMenu.itemArray[0].submenu.itemArray[2];
@@ -80,12 +82,17 @@ static void handle_idevice_event(const idevice_event_t *event, void *user_data)
     registerDeviceMenuItem.target = self;
     registerDeviceMenuItem.state = [[NSUserDefaults standardUserDefaults] boolForKey:@"RegisterDeviceAutomatically"] ? NSControlStateValueOn : NSControlStateValueOff;
     
+    archiveMenuItem = NSApp.mainMenu.itemArray[0].submenu.itemArray[6];
+    archiveMenuItem.action = @selector(didClickInstallAppsAsArchives:);
+    archiveMenuItem.target = self;
+    archiveMenuItem.state = [[NSUserDefaults standardUserDefaults] boolForKey:@"InstallAppsAsArchives"] ? NSControlStateValueOn : NSControlStateValueOff;
+    
     item = NSApp.mainMenu.itemArray[4].submenu.itemArray[0];
     item.action = @selector(showHelp:);
     item.target = self;
     NSApp.helpMenu = [NSMenu new];
     
-    mailPluginMenuItem = NSApp.mainMenu.itemArray[0].submenu.itemArray[7];
+    mailPluginMenuItem = NSApp.mainMenu.itemArray[0].submenu.itemArray[8];
     mailPluginMenuItem.action = @selector(didClickInstallPlugin:);
     mailPluginMenuItem.target = self;
     
@@ -145,6 +152,11 @@ static void handle_idevice_event(const idevice_event_t *event, void *user_data)
     [[NSUserDefaults standardUserDefaults] setBool:(registerDeviceMenuItem.state == NSControlStateValueOn) forKey:@"RegisterDeviceAutomatically"];
 }
 
+- (void)didClickInstallAppsAsArchives:(NSMenuItem *)sender {
+    [archiveMenuItem setState:archiveMenuItem.state == NSControlStateValueOn ? NSControlStateValueOff : NSControlStateValueOn];
+    [[NSUserDefaults standardUserDefaults] setBool:(archiveMenuItem.state == NSControlStateValueOn) forKey:@"InstallAppsAsArchives"];
+}
+
 - (void)showHelp:(NSMenuItem *)sender {
     NSURL *helpFile = [NSURL URLWithString:@"https://github.com/pixelomer/AltDeploy"];
     [[NSWorkspace sharedWorkspace] openURL:helpFile];
@@ -456,6 +468,7 @@ static void handle_idevice_event(const idevice_event_t *event, void *user_data)
     }
     [self setProgressVisible:YES];
     ALTDeviceManager.sharedManager.registerDeviceAutomatically = registerDeviceMenuItem.state == NSControlStateValueOn;
+    ALTDeviceManager.sharedManager.installsAppsAsArchives = archiveMenuItem.state == NSControlStateValueOn;
     ALTDevice *device = [[ALTDevice alloc] initWithName:@"targetDevice" identifier:devices[_deviceButton.indexOfSelectedItem]];
     NSProgress *progress = nil;
     progress = [ALTDeviceManager.sharedManager installApplicationTo:device
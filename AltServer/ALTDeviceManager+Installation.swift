@@ -501,19 +501,22 @@ To prevent this from happening, feel free to try again with another Apple ID to
     {
         DispatchQueue.global().async {
 			let resigner = ALTSigner(team: team, certificate: certificate)
-			resigner.signApp(at: application.fileURL, provisioningProfiles: [profile]) { (success, error) in
-				do
-				{
-					try Result(success, error).get()
-					
-					ALTDeviceManager.shared.installApp(at: application.fileURL, toDeviceWithUDID: device.identifier, progress: progress) { (success, error) in
-						completionHandler(Result(success, error))
+			
+			// Files are sent to the device as soon as signing is done with them, rather than once the whole app is signed.
+			ALTDeviceManager.shared.installApp(at: application.fileURL, toDeviceWithUDID: device.identifier, progress: progress, signingHandler: { (appBundleURL, fileHandler, signingCompletionHandler) in
+				resigner.signApp(at: appBundleURL, provisioningProfiles: [profile], fileHandler: fileHandler) { (success, error) in
+					do
+					{
+						try Result(success, error).get()
+						signingCompletionHandler(nil)
+					}
+					catch
+					{
+						signingCompletionHandler(error)
 					}
 				}
-				catch
-				{
-					completionHandler(.failure(error))
-				}
+			}) { (success, error) in
+				completionHandler(Result(success, error))
 			}
         }
     }
@@ -11,6 +11,9 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+// Called for each file of the app that's final, with its path in the app and SHA-256 hash.
+typedef void (^ALTDeviceManagerFileHandler)(NSString *relativePath, NSData *hash);
+
 @interface ALTDeviceManager : NSObject
 
 @property (class, nonatomic, readonly) ALTDeviceManager *sharedManager;
@@ -19,8 +22,16 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, readonly) NSArray<ALTDevice *> *availableDevices;
 @property (nonatomic, assign) BOOL registerDeviceAutomatically;
 
+// Sends apps to the device as a single uncompressed IPA rather than file by file. AltDeploy's
+// "Install Apps as Archives" menu item sets this; altserver-bench archive compares the two.
+@property (nonatomic, assign) BOOL installsAppsAsArchives;
+
 - (NSProgress *)installAppAtURL:(NSURL *)fileURL toDeviceWithUDID:(NSString *)udid progress:(NSProgress *)progress completionHandler:(void (^)(BOOL success, NSError *_Nullable error))completionHandler;
 
+// Signs the app while it's being sent: once the device is ready, signingHandler is asked to sign the app bundle,
+// passing files to fileHandler as they're final (when given one) and calling completionHandler once it's done.
+- (NSProgress *)installAppAtURL:(NSURL *)fileURL toDeviceWithUDID:(NSString *)udid progress:(NSProgress *)progress signingHandler:(nullable void (^)(NSURL *appBundleURL, ALTDeviceManagerFileHandler _Nullable fileHandler, void (^completionHandler)(NSError *_Nullable error)))signingHandler completionHandler:(void (^)(BOOL success, NSError *_Nullable error))completionHandler;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -16,6 +16,60 @@
 #include <libimobiledevice/afc.h>
 #include <libimobiledevice/misagent.h>
 
+#include <CommonCrypto/CommonDigest.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "ALTDeviceManagerUploader.hpp"
+
+// Large enough that AFC's per-write round trip is noise, small enough that two of them are nothing.
+static const size_t ALTDeviceManagerChunkSize = 4 << 20;
+
+// How many AFC connections a bundle is uploaded over.
+static const NSInteger ALTDeviceManagerUploadConnectionCount = 4;
+
+struct ALTDeviceManagerUpload
+{
+    NSURL *fileURL;
+    NSURL *destinationURL;
+    off_t size;
+};
+
+static NSData *ALTDeviceManagerSHA256(NSURL *fileURL)
+{
+    int fd = open(fileURL.fileSystemRepresentation, O_RDONLY);
+    if (fd == -1)
+    {
+        return nil;
+    }
+    
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    
+    char *buffer = (char *)malloc(ALTDeviceManagerChunkSize);
+    ssize_t length = 0;
+    while ((length = read(fd, buffer, ALTDeviceManagerChunkSize)) > 0)
+    {
+        CC_SHA256_Update(&context, buffer, (CC_LONG)length);
+    }
+    
+    free(buffer);
+    close(fd);
+    
+    if (length < 0)
+    {
+        return nil;
+    }
+    
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &context);
+    return [NSData dataWithBytes:digest length:sizeof(digest)];
+}
 
 void ALTDeviceManagerUpdateStatus(plist_t command, plist_t status, void *udid);
 
@@ -27,8 +81,54 @@ NSErrorDomain const ALTDeviceErrorDomain = @"com.rileytestut.ALTDeviceError";
 @property (nonatomic, readonly) NSMutableDictionary<NSUUID *, NSProgress *> *installationProgress;
 @property (nonatomic, readonly) dispatch_queue_t installationQueue;
 
+- (BOOL)writeFile:(NSURL *)fileURL toDestinationURL:(NSURL *)destinationURL client:(afc_client_t)afc error:(NSError **)error;
+
 @end
 
+// The AFC connections a bundle is uploaded over: afc, and as many more next to it as the device gives us, up to connectionCount.
+class ALTDeviceManagerAFCClients
+{
+public:
+    ALTDeviceManagerAFCClients(idevice_t device, lockdownd_client_t client, afc_client_t afc, NSInteger connectionCount)
+    {
+        // Each file costs a few round trips however small it is, so they are spread over several AFC connections.
+        clients.push_back(afc);
+        for (NSInteger i = 1; i < connectionCount; i++)
+        {
+            lockdownd_service_descriptor_t service = NULL;
+            afc_client_t extraClient = NULL;
+            
+            if (lockdownd_start_service(client, "com.apple.afc", &service) == LOCKDOWN_E_SUCCESS && service != NULL && afc_client_new(device, service, &extraClient) == AFC_E_SUCCESS)
+            {
+                clients.push_back(extraClient);
+            }
+            else
+            {
+                NSLog(@"Failed to open AFC connection %@, continuing with %@.", @(i + 1), @(clients.size()));
+            }
+            
+            lockdownd_service_descriptor_free(service);
+            
+            if (extraClient == NULL)
+            {
+                break;
+            }
+        }
+    }
+    
+    ~ALTDeviceManagerAFCClients()
+    {
+        for (size_t i = 1; i < clients.size(); i++)
+        {
+            afc_client_free(clients[i]);
+        }
+    }
+    
+    std::vector<afc_client_t> clients;
+};
+
+typedef ALTDeviceManagerUploader<afc_client_t, ALTDeviceManagerUpload, NSError *> ALTDeviceManagerAFCUploader;
+
 @implementation ALTDeviceManager
 
 + (ALTDeviceManager *)sharedManager
@@ -57,6 +157,11 @@ NSErrorDomain const ALTDeviceErrorDomain = @"com.rileytestut.ALTDeviceError";
 }
 
 - (NSProgress *)installAppAtURL:(NSURL *)fileURL toDeviceWithUDID:(NSString *)udid progress:(NSProgress *)UIProgress completionHandler:(void (^)(BOOL success, NSError *_Nullable error))completionHandler
+{
+    return [self installAppAtURL:fileURL toDeviceWithUDID:udid progress:UIProgress signingHandler:nil completionHandler:completionHandler];
+}
+
+- (NSProgress *)installAppAtURL:(NSURL *)fileURL toDeviceWithUDID:(NSString *)udid progress:(NSProgress *)UIProgress signingHandler:(void (^)(NSURL *appBundleURL, ALTDeviceManagerFileHandler fileHandler, void (^completionHandler)(NSError *error)))signingHandler completionHandler:(void (^)(BOOL success, NSError *_Nullable error))completionHandler
 {
     NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:4];
     
@@ -269,17 +374,113 @@ NSErrorDomain const ALTDeviceErrorDomain = @"com.rileytestut.ALTDeviceError";
         NSLog(@"Writing to device...");
         
         plist_t options = instproxy_client_options_new();
-        instproxy_client_options_add(options, "PackageType", "Developer", NULL);
+        NSURL *destinationURL = nil;
         
-        NSURL *destinationURL = [stagingURL URLByAppendingPathComponent:appBundleURL.lastPathComponent];
+        // The app is staged, and its manifest kept, under its bundle identifier: the bundle itself is usually extracted
+        // to a new temporary directory for every install, but the identifier stays the same from one install to the next.
+        ALTApplication *stagedApplication = [[ALTApplication alloc] initWithFileURL:appBundleURL];
+        NSString *stagingName = stagedApplication.bundleIdentifier ?: appBundleURL.lastPathComponent.stringByDeletingPathExtension;
         
         // Writing files to device should be worth 3/4 of total work.
         [progress becomeCurrentWithPendingUnitCount:3];
         
-        NSError *writeError = nil;
-        if (![self writeDirectory:appBundleURL toDestinationURL:destinationURL client:afc progress:nil error:&writeError])
+        if (self.installsAppsAsArchives)
+        {
+            // The archive can only be made once the app is signed.
+            if (signingHandler != nil)
+            {
+                __block NSError *signingError = nil;
+                dispatch_semaphore_t signingSemaphore = dispatch_semaphore_create(0);
+                
+                signingHandler(appBundleURL, nil, ^(NSError *error) {
+                    signingError = error;
+                    dispatch_semaphore_signal(signingSemaphore);
+                });
+                
+                dispatch_semaphore_wait(signingSemaphore, DISPATCH_TIME_FOREVER);
+                
+                if (signingError != nil)
+                {
+                    return finish(signingError);
+                }
+            }
+            
+            // One uncompressed IPA is sent as a single long write, instead of a few round trips for every file in the bundle.
+            NSError *zipError = nil;
+            NSURL *archiveURL = [[NSFileManager defaultManager] zipAppBundleAtURL:appBundleURL compressed:NO error:&zipError];
+            if (archiveURL == nil)
+            {
+                return finish(zipError);
+            }
+            
+            destinationURL = [stagingURL URLByAppendingPathComponent:[stagingName stringByAppendingPathExtension:@"ipa"]];
+            
+            NSError *writeError = nil;
+            BOOL success = [self writeFile:archiveURL toDestinationURL:destinationURL client:afc error:&writeError];
+            [[NSFileManager defaultManager] removeItemAtURL:archiveURL error:nil];
+            
+            if (!success)
+            {
+                return finish(writeError);
+            }
+        }
+        else
         {
-            return finish(writeError);
+            instproxy_client_options_add(options, "PackageType", "Developer", NULL);
+            destinationURL = [stagingURL URLByAppendingPathComponent:[stagingName stringByAppendingPathExtension:@"app"]];
+            
+            // The staging directory is kept between installs, so only files that changed since the last install to this device are sent.
+            NSURL *manifestURL = [self manifestURLForStagingName:stagingName deviceUDID:udid];
+            NSDictionary<NSString *, NSData *> *previousManifest = [NSDictionary dictionaryWithContentsOfURL:manifestURL];
+            
+            // A manifest only describes the device for as long as the staging directory it was written for is still there.
+            char **stagedInfo = NULL;
+            if (previousManifest != nil && afc_get_file_info(afc, destinationURL.relativePath.fileSystemRepresentation, &stagedInfo) != AFC_E_SUCCESS)
+            {
+                previousManifest = nil;
+            }
+            
+            if (stagedInfo)
+            {
+                afc_dictionary_free(stagedInfo);
+            }
+            
+            // Forget the old manifest before anything is sent, so an interrupted upload means a full one next time.
+            [[NSFileManager defaultManager] removeItemAtURL:manifestURL error:nil];
+            
+            // What's on the device, once files that are no longer in the app are gone. Signing doesn't remove files,
+            // so this is known before it starts, and a directory can take a removed file's place.
+            NSMutableDictionary<NSString *, NSData *> *stagedManifest = [previousManifest mutableCopy];
+            if (stagedManifest != nil)
+            {
+                for (NSString *relativePath in previousManifest)
+                {
+                    if ([[NSFileManager defaultManager] attributesOfItemAtPath:[appBundleURL URLByAppendingPathComponent:relativePath].path error:nil] == nil)
+                    {
+                        afc_remove_path(afc, [destinationURL URLByAppendingPathComponent:relativePath].relativePath.fileSystemRepresentation);
+                        [stagedManifest removeObjectForKey:relativePath];
+                    }
+                }
+            }
+            else
+            {
+                // Whatever an earlier, unrecorded install left behind is cleared out first.
+                afc_remove_path_and_contents(afc, destinationURL.relativePath.fileSystemRepresentation);
+            }
+            
+            // Signing goes on while the app is sent, and whatever differs from what's staged is sent once it's done.
+            NSDictionary<NSString *, NSData *> *manifest = nil;
+            NSError *writeError = nil;
+            if (![self writeAppAtURL:appBundleURL toDestinationURL:destinationURL signingHandler:signingHandler stagedManifest:[stagedManifest copy] manifest:&manifest device:device client:client afc:afc error:&writeError])
+            {
+                return finish(writeError);
+            }
+            
+            if (manifest != nil)
+            {
+                [[NSFileManager defaultManager] createDirectoryAtURL:manifestURL.URLByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:nil];
+                [manifest writeToURL:manifestURL atomically:YES];
+            }
         }
         
         NSLog(@"Finished writing to device.");
@@ -423,81 +624,248 @@ NSErrorDomain const ALTDeviceErrorDomain = @"com.rileytestut.ALTDeviceError";
     return progress;
 }
 
-- (BOOL)writeDirectory:(NSURL *)directoryURL toDestinationURL:(NSURL *)destinationURL client:(afc_client_t)afc progress:(NSProgress *)progress error:(NSError **)error
+- (NSURL *)manifestURLForStagingName:(NSString *)stagingName deviceUDID:(NSString *)udid
+{
+    NSURL *cachesURL = [[NSFileManager defaultManager] URLForDirectory:NSCachesDirectory inDomain:NSUserDomainMask appropriateForURL:nil create:YES error:nil];
+    NSURL *manifestsURL = [[(cachesURL ?: [[NSFileManager defaultManager] temporaryDirectory]) URLByAppendingPathComponent:(NSBundle.mainBundle.bundleIdentifier ?: @"AltServer") isDirectory:YES] URLByAppendingPathComponent:@"Manifests" isDirectory:YES];
+    return [[manifestsURL URLByAppendingPathComponent:udid isDirectory:YES] URLByAppendingPathComponent:[stagingName stringByAppendingPathExtension:@"plist"]];
+}
+
+- (nullable NSDictionary<NSString *, NSData *> *)manifestForAppAtURL:(NSURL *)appBundleURL
 {
-    afc_make_directory(afc, destinationURL.relativePath.fileSystemRepresentation);
+    NSMutableArray<NSString *> *relativePaths = [NSMutableArray array];
+    NSMutableDictionary<NSString *, NSData *> *resourceHashes = [NSMutableDictionary dictionary];
     
-    if (progress == nil)
+    // ldid has already hashed every resource with SHA-256 for the CodeResources of its bundle,
+    // so only what those leave out (executables, and the CodeResources themselves) is hashed here.
+    NSDirectoryEnumerator *enumerator = [[NSFileManager defaultManager] enumeratorAtPath:appBundleURL.path];
+    for (NSString *relativePath in enumerator)
     {
-        NSDirectoryEnumerator *countEnumerator = [[NSFileManager defaultManager] enumeratorAtURL:directoryURL
-                                                                      includingPropertiesForKeys:@[]
-                                                                                         options:0
-                                                                                    errorHandler:^BOOL(NSURL * _Nonnull url, NSError * _Nonnull error) {
-                                                                                        if (error) {
-                                                                                            NSLog(@"[Error] %@ (%@)", error, url);
-                                                                                            return NO;
-                                                                                        }
-                                                                                        
-                                                                                        return YES;
-                                                                                    }];
+        if ([enumerator.fileAttributes[NSFileType] isEqualToString:NSFileTypeDirectory])
+        {
+            continue;
+        }
+        
+        [relativePaths addObject:relativePath];
         
-        NSInteger totalCount = 0;
-        for (NSURL *__unused fileURL in countEnumerator)
+        NSString *signatureDirectory = relativePath.stringByDeletingLastPathComponent;
+        if (![relativePath.lastPathComponent isEqualToString:@"CodeResources"] || ![signatureDirectory.lastPathComponent isEqualToString:@"_CodeSignature"])
         {
-            totalCount++;
+            continue;
         }
         
-        progress = [NSProgress progressWithTotalUnitCount:totalCount];
+        NSString *bundlePath = signatureDirectory.stringByDeletingLastPathComponent;
+        NSDictionary *codeResources = [NSDictionary dictionaryWithContentsOfURL:[appBundleURL URLByAppendingPathComponent:relativePath]];
+        
+        NSDictionary *files = codeResources[@"files2"];
+        if (![files isKindOfClass:[NSDictionary class]])
+        {
+            continue;
+        }
+        
+        [files enumerateKeysAndObjectsUsingBlock:^(NSString *path, id file, BOOL *stop) {
+            NSData *hash = [file isKindOfClass:[NSDictionary class]] ? file[@"hash2"] : nil;
+            if ([hash isKindOfClass:[NSData class]])
+            {
+                resourceHashes[[bundlePath stringByAppendingPathComponent:path]] = hash;
+            }
+        }];
     }
     
-    NSDirectoryEnumerator *enumerator = [[NSFileManager defaultManager] enumeratorAtURL:directoryURL
-                                                             includingPropertiesForKeys:@[NSURLIsDirectoryKey]
-                                                                                options:NSDirectoryEnumerationSkipsSubdirectoryDescendants
-                                                                           errorHandler:^BOOL(NSURL * _Nonnull url, NSError * _Nonnull error) {
-                                                                               if (error) {
-                                                                                   NSLog(@"[Error] %@ (%@)", error, url);
-                                                                                   return NO;
-                                                                               }
-                                                                               
-                                                                               return YES;
-                                                                           }];
-    
-    for (NSURL *fileURL in enumerator)
+    NSMutableDictionary<NSString *, NSData *> *manifest = [NSMutableDictionary dictionary];
+    for (NSString *relativePath in relativePaths)
     {
-        NSNumber *isDirectory = nil;
-        if (![fileURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:error])
+        NSData *hash = resourceHashes[relativePath] ?: ALTDeviceManagerSHA256([appBundleURL URLByAppendingPathComponent:relativePath]);
+        if (hash == nil)
         {
-            return NO;
+            // Without a hash for every file, there's nothing to compare against next time.
+            return nil;
         }
         
-        if ([isDirectory boolValue])
+        manifest[relativePath] = hash;
+    }
+    
+    return manifest;
+}
+
+- (BOOL)writeAppAtURL:(NSURL *)appBundleURL toDestinationURL:(NSURL *)destinationURL signingHandler:(nullable void (^)(NSURL *appBundleURL, ALTDeviceManagerFileHandler fileHandler, void (^completionHandler)(NSError *error)))signingHandler stagedManifest:(nullable NSDictionary<NSString *, NSData *> *)stagedManifest manifest:(NSDictionary<NSString *, NSData *> *_Nullable *_Nonnull)manifest device:(idevice_t)device client:(lockdownd_client_t)client afc:(afc_client_t)afc error:(NSError **)error
+{
+    // Directories are all created up front, so a file can be sent the moment signing is done with it,
+    // and the connections never wait on each other.
+    NSMutableOrderedSet<NSString *> *directories = [NSMutableOrderedSet orderedSetWithObject:@""];
+    NSInteger fileCount = 0;
+    
+    NSDirectoryEnumerator *enumerator = [[NSFileManager defaultManager] enumeratorAtPath:appBundleURL.path];
+    for (NSString *relativePath in enumerator)
+    {
+        if ([enumerator.fileAttributes[NSFileType] isEqualToString:NSFileTypeDirectory])
         {
-            NSURL *destinationDirectoryURL = [destinationURL URLByAppendingPathComponent:fileURL.lastPathComponent isDirectory:YES];
-            if (![self writeDirectory:fileURL toDestinationURL:destinationDirectoryURL client:afc progress:progress error:error])
+            [directories addObject:relativePath];
+        }
+        else
+        {
+            fileCount++;
+        }
+    }
+    
+    for (NSString *relativePath in directories)
+    {
+        NSURL *destinationDirectoryURL = relativePath.length == 0 ? destinationURL : [destinationURL URLByAppendingPathComponent:relativePath isDirectory:YES];
+        afc_make_directory(afc, destinationDirectoryURL.relativePath.fileSystemRepresentation);
+    }
+    
+    // One progress for the whole app; files that are already on the device count as soon as that's known.
+    NSProgress *progress = [NSProgress progressWithTotalUnitCount:fileCount];
+    
+    // Everything goes through one uploader, so there's only ever one set of AFC connections to the device.
+    ALTDeviceManagerAFCClients clients(device, client, afc, ALTDeviceManagerUploadConnectionCount);
+    ALTDeviceManagerAFCUploader uploader(clients.clients, [self](afc_client_t uploadClient, const ALTDeviceManagerUpload &upload) -> NSError * {
+        @autoreleasepool
+        {
+            NSError *writeError = nil;
+            return [self writeFile:upload.fileURL toDestinationURL:upload.destinationURL client:uploadClient error:&writeError] ? nil : writeError;
+        }
+    }, [progress] {
+        progress.completedUnitCount += 1;
+    });
+    
+    NSMutableSet<NSString *> *handledPaths = [NSMutableSet set];
+    
+    if (signingHandler != nil)
+    {
+        // Files that signing leaves untouched are sent while the rest of the app is still being signed, over every
+        // connection but afc, which is kept free for any directories signing adds.
+        uploader.Start();
+        
+        // Blocks copy the C++ objects they capture, so they're given a pointer to it instead.
+        ALTDeviceManagerAFCUploader *pendingUploads = &uploader;
+        
+        __block NSError *signingError = nil;
+        dispatch_semaphore_t signingSemaphore = dispatch_semaphore_create(0);
+        
+        signingHandler(appBundleURL, ^(NSString *relativePath, NSData *hash) {
+            @synchronized (handledPaths)
+            {
+                [handledPaths addObject:relativePath];
+            }
+            
+            if ([stagedManifest[relativePath] isEqual:hash])
+            {
+                progress.completedUnitCount += 1;
+                return;
+            }
+            
+            ALTDeviceManagerUpload upload;
+            upload.fileURL = [appBundleURL URLByAppendingPathComponent:relativePath isDirectory:NO];
+            upload.destinationURL = [destinationURL URLByAppendingPathComponent:relativePath isDirectory:NO];
+            
+            struct stat info;
+            upload.size = stat(upload.fileURL.fileSystemRepresentation, &info) == 0 ? info.st_size : 0;
+            
+            pendingUploads->Add(upload);
+        }, ^(NSError *error) {
+            signingError = error;
+            dispatch_semaphore_signal(signingSemaphore);
+        });
+        
+        dispatch_semaphore_wait(signingSemaphore, DISPATCH_TIME_FOREVER);
+        
+        if (signingError != nil)
+        {
+            // The uploader drops whatever it hasn't sent yet when it goes away without being run.
+            if (error)
             {
-                return NO;
+                *error = signingError;
             }
+            
+            return NO;
         }
-        else
+    }
+    
+    // Everything else, which now includes what signing changed, is compared with what's on the device.
+    NSDictionary<NSString *, NSData *> *appManifest = [self manifestForAppAtURL:appBundleURL];
+    
+    std::vector<ALTDeviceManagerUpload> uploads;
+    NSInteger totalCount = 0;
+    
+    enumerator = [[NSFileManager defaultManager] enumeratorAtPath:appBundleURL.path];
+    for (NSString *relativePath in enumerator)
+    {
+        if ([enumerator.fileAttributes[NSFileType] isEqualToString:NSFileTypeDirectory])
         {
-            NSURL *destinationFileURL = [destinationURL URLByAppendingPathComponent:fileURL.lastPathComponent isDirectory:NO];
-            if (![self writeFile:fileURL toDestinationURL:destinationFileURL client:afc error:error])
+            // Nothing has been sent over afc yet, so it can still make the directories signing added.
+            if (![directories containsObject:relativePath])
             {
-                return NO;
+                [directories addObject:relativePath];
+                afc_make_directory(afc, [destinationURL URLByAppendingPathComponent:relativePath isDirectory:YES].relativePath.fileSystemRepresentation);
             }
+            
+            continue;
         }
         
-        progress.completedUnitCount += 1;
+        totalCount++;
+        
+        if ([handledPaths containsObject:relativePath])
+        {
+            continue;
+        }
+        
+        if (appManifest != nil && [stagedManifest[relativePath] isEqual:appManifest[relativePath]])
+        {
+            progress.completedUnitCount += 1;
+            continue;
+        }
+        
+        ALTDeviceManagerUpload upload;
+        upload.fileURL = [appBundleURL URLByAppendingPathComponent:relativePath isDirectory:NO];
+        upload.destinationURL = [destinationURL URLByAppendingPathComponent:relativePath isDirectory:NO];
+        upload.size = [enumerator.fileAttributes[NSFileSize] longLongValue];
+        uploads.push_back(upload);
+    }
+    
+    // Signing can add files, which the same progress goes on to count.
+    progress.totalUnitCount = totalCount;
+    
+    NSLog(@"Sending %@ more of %@ files.", @(uploads.size()), @(totalCount));
+    
+    // The largest files go first, so that no connection is left sending a big one on its own at the end.
+    std::stable_sort(uploads.begin(), uploads.end(), [](const ALTDeviceManagerUpload &lhs, const ALTDeviceManagerUpload &rhs) {
+        return lhs.size > rhs.size;
+    });
+    
+    for (const auto &upload : uploads)
+    {
+        uploader.Add(upload);
     }
     
+    uploader.Close();
+    
+    NSError *uploadError = nil;
+    if (!uploader.Run(&uploadError))
+    {
+        if (error)
+        {
+            *error = uploadError;
+        }
+        
+        return NO;
+    }
+    
+    *manifest = appManifest;
     return YES;
 }
 
 - (BOOL)writeFile:(NSURL *)fileURL toDestinationURL:(NSURL *)destinationURL client:(afc_client_t)afc error:(NSError **)error
 {
-    NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingAtPath:fileURL.path];
-    if (fileHandle == nil)
+    int fd = open(fileURL.fileSystemRepresentation, O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) != 0)
     {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        
         if (error)
         {
             *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:@{NSURLErrorKey: fileURL}];
@@ -506,11 +874,11 @@ NSErrorDomain const ALTDeviceErrorDomain = @"com.rileytestut.ALTDeviceError";
         return NO;
     }
     
-    NSData *data = [fileHandle readDataToEndOfFile];
-
     uint64_t af = 0;
     if ((afc_file_open(afc, destinationURL.relativePath.fileSystemRepresentation, AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) || af == 0)
     {
+        close(fd);
+        
         if (error)
         {
             *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: destinationURL}];
@@ -519,28 +887,75 @@ NSErrorDomain const ALTDeviceErrorDomain = @"com.rileytestut.ALTDeviceError";
         return NO;
     }
     
+    // Files are sent in chunks through two buffers, so memory use doesn't grow with the file,
+    // and the next chunk is read from disk while the current one is written to the device.
+    off_t fileSize = info.st_size;
+    char *buffers = (char *)malloc(2 * ALTDeviceManagerChunkSize);
+    
+    dispatch_group_t readGroup = dispatch_group_create();
+    dispatch_queue_t readQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+    
+    // The first chunk is read right away; most files fit in it, and don't need another thread.
+    __block ssize_t readLength = pread(fd, buffers, (size_t)MIN((off_t)ALTDeviceManagerChunkSize, fileSize), 0);
+    
     BOOL success = YES;
-    uint32_t bytesWritten = 0;
-        
-    while (bytesWritten < data.length)
+    off_t bytesWritten = 0;
+    int index = 0;
+    
+    while (bytesWritten < fileSize)
     {
-        uint32_t count = 0;
+        dispatch_group_wait(readGroup, DISPATCH_TIME_FOREVER);
         
-        if (afc_file_write(afc, af, (const char *)data.bytes + bytesWritten, (uint32_t)data.length - bytesWritten, &count) != AFC_E_SUCCESS)
+        ssize_t length = readLength;
+        if (length <= 0)
         {
-            if (error)
+            success = NO;
+            break;
+        }
+        
+        char *chunk = buffers + index * ALTDeviceManagerChunkSize;
+        off_t nextOffset = bytesWritten + length;
+        
+        if (nextOffset < fileSize)
+        {
+            char *nextChunk = buffers + (1 - index) * ALTDeviceManagerChunkSize;
+            size_t nextLength = (size_t)MIN((off_t)ALTDeviceManagerChunkSize, fileSize - nextOffset);
+            
+            dispatch_group_async(readGroup, readQueue, ^{
+                readLength = pread(fd, nextChunk, nextLength, nextOffset);
+            });
+        }
+        
+        ssize_t chunkWritten = 0;
+        while (chunkWritten < length)
+        {
+            uint32_t count = 0;
+            
+            if (afc_file_write(afc, af, chunk + chunkWritten, (uint32_t)(length - chunkWritten), &count) != AFC_E_SUCCESS || count == 0)
             {
-                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{NSURLErrorKey: destinationURL}];
+                success = NO;
+                break;
             }
             
-            success = NO;
+            chunkWritten += count;
+        }
+        
+        if (!success)
+        {
             break;
         }
         
-        bytesWritten += count;
+        bytesWritten = nextOffset;
+        index = 1 - index;
     }
     
-    if (bytesWritten != data.length)
+    // A read may still be filling the other buffer if writing failed.
+    dispatch_group_wait(readGroup, DISPATCH_TIME_FOREVER);
+    
+    free(buffers);
+    close(fd);
+    
+    if (!success || bytesWritten != fileSize)
     {
         if (error)
         {
@@ -0,0 +1,173 @@
+//
+//  ALTDeviceManagerUploader.hpp
+//  AltServer
+//
+//  Plain C++, so it can be driven without a device (see AltServer/bench.cpp).
+//
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How small files are handed out to connections.
+static const off_t ALTDeviceManagerSmallFileSize = 64 << 10;
+static const size_t ALTDeviceManagerUploadBatchSize = 32;
+
+// Sends files over several connections as they're added, which can go on while they're still being produced.
+// Sending a file is left to the writer, which returns an Error that converts to false on success; an Upload only needs a size.
+template <typename Connection, typename Upload, typename Error>
+class ALTDeviceManagerUploader
+{
+public:
+    typedef std::function<Error (Connection connection, const Upload &upload)> Writer;
+    
+    ALTDeviceManagerUploader(const std::vector<Connection> &connections, Writer writer, std::function<void ()> sentHandler) : connections(connections), writer(writer), sentHandler(sentHandler), closed(false), failed(false), uploadError()
+    {
+    }
+    
+    ~ALTDeviceManagerUploader()
+    {
+        // Started but never run: whatever is left is dropped, so the connections are done with before they go away.
+        if (!threads.empty())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed = true;
+                uploads.clear();
+                condition.notify_all();
+            }
+            
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+        }
+    }
+    
+    // Safe to call from any thread; files added after an upload failed are dropped.
+    void Add(const Upload &upload)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed)
+        {
+            return;
+        }
+        
+        uploads.push_back(upload);
+        condition.notify_one();
+    }
+    
+    // No more files are coming.
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        condition.notify_all();
+    }
+    
+    // Starts sending over every connection but the first, which is left to the caller until Run.
+    void Start()
+    {
+        for (size_t i = threads.size() + 1; i < connections.size(); i++)
+        {
+            threads.emplace_back(&ALTDeviceManagerUploader::Send, this, connections[i]);
+        }
+    }
+    
+    // Sends files over every connection until it's closed and they're all sent, or one fails.
+    bool Run(Error *error)
+    {
+        Start();
+        Send(connections[0]);
+        
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        
+        threads.clear();
+        
+        // Even after a failure, whoever is adding files has to be done with us before we go away.
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return closed; });
+        
+        if (failed)
+        {
+            if (error)
+            {
+                *error = uploadError;
+            }
+            
+            return false;
+        }
+        
+        return true;
+    }
+
+private:
+    std::vector<Connection> connections;
+    Writer writer;
+    std::function<void ()> sentHandler;
+    std::vector<std::thread> threads;
+    
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Upload> uploads;
+    bool closed;
+    bool failed;
+    Error uploadError;
+    
+    void Send(Connection connection)
+    {
+        for (;;)
+        {
+            std::vector<Upload> batch;
+            
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] { return failed || closed || !uploads.empty(); });
+                
+                if (failed || uploads.empty())
+                {
+                    return;
+                }
+                
+                // Small files are handed out in batches, so connections don't take turns at the lock.
+                do
+                {
+                    batch.push_back(uploads.front());
+                    uploads.pop_front();
+                }
+                while (batch.back().size < ALTDeviceManagerSmallFileSize && batch.size() < ALTDeviceManagerUploadBatchSize && !uploads.empty() && uploads.front().size < ALTDeviceManagerSmallFileSize);
+            }
+            
+            for (const auto &upload : batch)
+            {
+                Error writeError = writer(connection, upload);
+                
+                std::lock_guard<std::mutex> lock(mutex);
+                if (writeError)
+                {
+                    if (!failed)
+                    {
+                        failed = true;
+                        uploadError = writeError;
+                        uploads.clear();
+                        condition.notify_all();
+                    }
+                    
+                    return;
+                }
+                
+                sentHandler();
+            }
+        }
+    }
+};
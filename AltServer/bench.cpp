@@ -0,0 +1,324 @@
+/* altserver-bench - drive ALTDeviceManagerUploader against a mock AFC device
+ *
+ * Needs nothing but a host compiler, so it runs without libimobiledevice or
+ * a device:
+ *
+ *   c++ -std=gnu++14 -O2 -o altserver-bench AltServer/bench.cpp -lpthread
+ *
+ *   altserver-bench upload --files 2000 --file-size 16K --connections 4
+ *   altserver-bench upload --files 500 --large 4 --large-size 64M --latency 2 --stream
+ *   altserver-bench upload --files 500 --fail 100 --stream
+ *   altserver-bench archive --files 2000 --file-size 16K --large 2 --large-size 32M
+ *
+ * Each request to the mock costs a round trip, and the bytes it carries go
+ * over a link every connection shares. A file costs what writeFile: spends
+ * on it: an open, one write per chunk, and a close. Every run checks that
+ * each file arrived exactly once, that no connection was ever used by two
+ * threads at a time, and that a failed write stops the upload with its error.
+ *
+ * archive compares sending the files one by one with sending them as one
+ * uncompressed IPA over a single connection, as installsAppsAsArchives does.
+ * Only the transfer is measured: zipping the bundle costs what ldid-bench
+ * zip --level 0 reports, and the device then has to extract it.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+#include "../ldid/bench.hpp"
+#include "ALTDeviceManagerUploader.hpp"
+
+// as ALTDeviceManagerChunkSize
+static const off_t ChunkSize_ = 4 << 20;
+
+struct Options {
+    std::string mode_;
+    unsigned repeat_ = 3;
+    size_t files_ = 2000;
+    size_t file_ = 16 << 10;
+    size_t large_ = 0;
+    size_t largeSize_ = 64 << 20;
+    size_t connections_ = 4;
+    double latency_ = 1;
+    size_t bandwidth_ = 30 << 20;
+    bool stream_ = false;
+    size_t fail_ = 0;
+};
+
+static void usage() {
+    fprintf(stderr, "usage: altserver-bench upload [--files N] [--file-size N] [--large N] [--large-size N] [--connections N]\n");
+    fprintf(stderr, "                              [--latency ms] [--bandwidth N] [--stream] [--fail N] [--repeat N]\n");
+    fprintf(stderr, "       altserver-bench archive [--files N] [--file-size N] [--large N] [--large-size N] [--connections N]\n");
+    fprintf(stderr, "                               [--latency ms] [--bandwidth N] [--stream] [--repeat N]\n");
+    fprintf(stderr, "       sizes take K, M and G suffixes; --bandwidth is per second\n");
+    exit(1);
+}
+
+static size_t size(const char *value) {
+    size_t number;
+    if (!ParseSize(value, number))
+        usage();
+    return number;
+}
+
+static void wait(double seconds) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+/* Mock Device {{{ */
+struct Upload {
+    std::string path_;
+    off_t size;
+};
+
+struct Device;
+
+struct Connection {
+    Device *device_;
+    std::atomic<bool> busy_;
+    size_t requests_;
+
+    Connection(Device *device) :
+        device_(device),
+        busy_(false),
+        requests_(0)
+    {
+    }
+};
+
+struct Device {
+    double latency_;
+    double bandwidth_;
+
+    // the one USB or Wi-Fi link every connection goes over
+    std::mutex link_;
+
+    std::mutex mutex_;
+    std::map<std::string, unsigned> received_;
+    size_t overlaps_;
+
+    Device(double latency, double bandwidth) :
+        latency_(latency),
+        bandwidth_(bandwidth),
+        overlaps_(0)
+    {
+    }
+
+    void Request(Connection *connection, off_t bytes) {
+        if (connection->busy_.exchange(true)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++overlaps_;
+        }
+
+        ++connection->requests_;
+        wait(latency_);
+
+        if (bytes != 0) {
+            std::lock_guard<std::mutex> lock(link_);
+            wait(bytes / bandwidth_);
+        }
+
+        connection->busy_ = false;
+    }
+
+    void Receive(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++received_[path];
+    }
+};
+/* }}} */
+
+typedef ALTDeviceManagerUploader<Connection *, Upload, const char *> Uploader;
+
+static std::vector<Upload> Uploads(const Options &options) {
+    std::vector<Upload> uploads;
+    for (size_t i(0); i != options.large_; ++i)
+        uploads.push_back(Upload{"Frameworks/" + std::to_string(i) + ".framework/Binary", off_t(options.largeSize_)});
+    for (size_t i(0); i != options.files_; ++i)
+        uploads.push_back(Upload{"Assets/" + std::to_string(i / 256) + "/" + std::to_string(i) + ".bin", off_t(options.file_)});
+    return uploads;
+}
+
+// the same files as one stored IPA: a local header and a central directory entry per file, and the end record
+static std::vector<Upload> Archive(const std::vector<Upload> &uploads) {
+    static const std::string prefix("Payload/Bench.app/");
+    off_t size(22);
+    for (const auto &upload : uploads)
+        size += upload.size + 30 + 46 + 2 * (prefix.size() + upload.path_.size());
+    return std::vector<Upload>(1, Upload{"PublicStaging/com.example.bench.ipa", size});
+}
+
+// one upload, checked; false if anything about it was wrong
+static bool Run(const Options &options, const std::vector<Upload> &uploads, const char *label, unsigned run) {
+    Device device(options.latency_ / 1000, options.bandwidth_);
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::vector<Connection *> clients;
+    for (size_t i(0); i != std::max<size_t>(1, options.connections_); ++i) {
+        connections.emplace_back(new Connection(&device));
+        clients.push_back(connections.back().get());
+    }
+
+    std::atomic<size_t> written(0);
+    std::atomic<size_t> sent(0);
+
+    Uploader uploader(clients, [&](Connection *connection, const Upload &upload) -> const char * {
+        if (written.fetch_add(1) + 1 == options.fail_)
+            return "write failed";
+
+        device.Request(connection, 0);
+        for (off_t offset(0); offset < upload.size; offset += ChunkSize_)
+            device.Request(connection, std::min(ChunkSize_, upload.size - offset));
+        device.Request(connection, 0);
+
+        device.Receive(upload.path_);
+        return NULL;
+    }, [&]() {
+        ++sent;
+    });
+
+    auto start(now());
+    bool valid(true);
+
+    // with --stream, half the files turn up one by one as they would while the app is being signed, and are sent
+    // over every connection but the first; the rest are added once that's done, as ALTDeviceManager does
+    size_t streamed(options.stream_ ? uploads.size() / 2 : 0);
+    if (streamed != 0) {
+        uploader.Start();
+
+        std::thread signer([&]() {
+            for (size_t i(0); i != streamed; ++i) {
+                wait(device.latency_ / 4);
+                uploader.Add(uploads[i]);
+            }
+        });
+        signer.join();
+
+        if (clients[0]->requests_ != 0) {
+            fprintf(stderr, "altserver-bench: the first connection was used before Run\n");
+            valid = false;
+        }
+    }
+
+    for (size_t i(streamed); i != uploads.size(); ++i)
+        uploader.Add(uploads[i]);
+    uploader.Close();
+
+    const char *error(NULL);
+    bool success(uploader.Run(&error));
+
+    auto total(now() - start);
+
+    size_t requests(0);
+    for (const auto &connection : connections)
+        requests += connection->requests_;
+
+    printf("%srun %u: %.3fs  %zu requests  %zu files sent", label, run, total, requests, sent.load());
+    if (!success)
+        printf("  error: %s", error);
+    printf("\n");
+
+    if (device.overlaps_ != 0) {
+        fprintf(stderr, "altserver-bench: a connection was used by two threads at once %zu times\n", device.overlaps_);
+        valid = false;
+    }
+
+    for (const auto &entry : device.received_)
+        if (entry.second != 1) {
+            fprintf(stderr, "altserver-bench: %s arrived %u times\n", entry.first.c_str(), entry.second);
+            valid = false;
+        }
+
+    if (sent != device.received_.size()) {
+        fprintf(stderr, "altserver-bench: %zu files counted as sent, %zu arrived\n", sent.load(), device.received_.size());
+        valid = false;
+    }
+
+    if (options.fail_ != 0 && options.fail_ <= uploads.size()) {
+        if (success || error == NULL || strcmp(error, "write failed") != 0) {
+            fprintf(stderr, "altserver-bench: the failed write wasn't reported\n");
+            valid = false;
+        }
+    } else if (!success || sent != uploads.size()) {
+        fprintf(stderr, "altserver-bench: %zu of %zu files arrived\n", sent.load(), uploads.size());
+        valid = false;
+    }
+
+    return valid;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2)
+        usage();
+
+    Options options;
+    options.mode_ = argv[1];
+
+    for (int i(2); i != argc; ++i) {
+        std::string flag(argv[i]);
+        if (flag == "--stream") {
+            options.stream_ = true;
+            continue;
+        }
+
+        if (i + 1 == argc)
+            usage();
+        const char *value(argv[++i]);
+
+        if (flag == "--repeat")
+            options.repeat_ = strtoul(value, NULL, 0);
+        else if (flag == "--files")
+            options.files_ = strtoull(value, NULL, 0);
+        else if (flag == "--file-size")
+            options.file_ = size(value);
+        else if (flag == "--large")
+            options.large_ = strtoull(value, NULL, 0);
+        else if (flag == "--large-size")
+            options.largeSize_ = size(value);
+        else if (flag == "--connections")
+            options.connections_ = strtoull(value, NULL, 0);
+        else if (flag == "--latency")
+            options.latency_ = strtod(value, NULL);
+        else if (flag == "--bandwidth")
+            options.bandwidth_ = size(value);
+        else if (flag == "--fail" && options.mode_ == "upload")
+            options.fail_ = strtoull(value, NULL, 0);
+        else
+            usage();
+    }
+
+    auto uploads(Uploads(options));
+    bool valid(true);
+
+    printf("%s: %zu files of %zu bytes, %zu of %zu bytes, %zu connections, %.1fms round trips, %zuM/s\n", options.mode_.c_str(), options.files_, options.file_, options.large_, options.largeSize_, options.connections_, options.latency_, options.bandwidth_ >> 20);
+
+    if (options.mode_ == "upload") {
+        for (unsigned run(0); run != options.repeat_; ++run)
+            valid = Run(options, uploads, "", run) && valid;
+    } else if (options.mode_ == "archive") {
+        // the archive can only be made once the app is signed, and is one file, so one connection is all it uses
+        Options archive(options);
+        archive.connections_ = 1;
+        archive.stream_ = false;
+
+        auto ipa(Archive(uploads));
+        for (unsigned run(0); run != options.repeat_; ++run) {
+            valid = Run(options, uploads, "files   ", run) && valid;
+            valid = Run(archive, ipa, "archive ", run) && valid;
+        }
+    } else
+        usage();
+
+    return valid ? 0 : 1;
+}
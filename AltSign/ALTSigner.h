@@ -24,6 +24,10 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (NSProgress *)signAppAtURL:(NSURL *)appURL provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles completionHandler:(void (^)(BOOL success, NSError *_Nullable error))completionHandler;
 
+// fileHandler is called, from any thread, for each file signing leaves as it is once it's final, with its path in the app and SHA-256 hash.
+// Only used for app bundles; whatever signing changes (executables, CodeResources) is only final once completionHandler is called.
+- (NSProgress *)signAppAtURL:(NSURL *)appURL provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles fileHandler:(nullable void (^)(NSString *relativePath, NSData *hash))fileHandler completionHandler:(void (^)(BOOL success, NSError *_Nullable error))completionHandler;
+
 @end
 
 NS_ASSUME_NONNULL_END
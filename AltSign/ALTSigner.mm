@@ -18,16 +18,46 @@
 
 #include "ldid.hpp"
 
+#include <map>
 #include <string>
+#include <vector>
 
 #include <openssl/pkcs12.h>
 #include <openssl/pem.h>
 
-std::string CertificatesContent(ALTCertificate *altCertificate)
+// apple.pem never changes while we're running, so it's only read and parsed once.
+static STACK_OF(X509) *AppleCertificates()
 {
-    NSURL *pemURL = [NSBundle.mainBundle URLForResource:@"apple" withExtension:@"pem"];
-    NSLog(@"pem: %@", pemURL);
+    static STACK_OF(X509) *certificates = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSURL *pemURL = [NSBundle.mainBundle URLForResource:@"apple" withExtension:@"pem"];
+        NSLog(@"pem: %@", pemURL);
+        
+        certificates = sk_X509_new(NULL);
+        
+        // Open .pem from file.
+        auto pemFile = fopen(pemURL.path.fileSystemRepresentation, "r");
+        if (pemFile == NULL)
+        {
+            return;
+        }
+        
+        // Extract certificates from .pem.
+        while (auto certificate = PEM_read_X509(pemFile, NULL, NULL, NULL))
+        {
+            sk_X509_push(certificates, certificate);
+        }
+        
+        fclose(pemFile);
+    });
     
+    return certificates;
+}
+
+std::string CertificatesContent(ALTCertificate *altCertificate)
+{
+    // Called once per signing; the key it holds isn't kept around once that's done.
     NSData *altCertificateP12Data = [altCertificate p12Data];
     
     BIO *inputP12Buffer = BIO_new(BIO_s_mem());
@@ -36,23 +66,13 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
     auto inputP12 = d2i_PKCS12_bio(inputP12Buffer, NULL);
     
     // Extract key + certificate from .p12.
-    EVP_PKEY *key;
-    X509 *certificate;
+    EVP_PKEY *key = NULL;
+    X509 *certificate = NULL;
     PKCS12_parse(inputP12, "", &key, &certificate, NULL);
     
-    // Open .pem from file.
-    auto pemFile = fopen(pemURL.path.fileSystemRepresentation, "r");
-    
-    // Extract certificates from .pem.
-    auto *certificates = sk_X509_new(NULL);
-    while (auto certificate = PEM_read_X509(pemFile, NULL, NULL, NULL))
-    {
-        sk_X509_push(certificates, certificate);
-    }
-    
     // Create new .p12 in memory with private key and certificate chain.
     char emptyString[] = "";
-    auto outputP12 = PKCS12_create(emptyString, emptyString, key, certificate, certificates, 0, 0, 0, 0, 0);
+    auto outputP12 = PKCS12_create(emptyString, emptyString, key, certificate, AppleCertificates(), 0, 0, 0, 0, 0);
     
     BIO *outputP12Buffer = BIO_new(BIO_s_mem());
     i2d_PKCS12_bio(outputP12Buffer, outputP12);
@@ -60,22 +80,58 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
     char *buffer = NULL;
     NSUInteger size = BIO_get_mem_data(outputP12Buffer, &buffer);
     
-    NSData *p12Data = [NSData dataWithBytes:buffer length:size];
+    std::string output(buffer, (size_t)size);
     
     // Free .p12 structures
     PKCS12_free(inputP12);
     PKCS12_free(outputP12);
     
+    EVP_PKEY_free(key);
+    X509_free(certificate);
+    
     BIO_free(inputP12Buffer);
     BIO_free(outputP12Buffer);
     
-    // Close files
-    fclose(pemFile);
-    
-    std::string output((const char *)p12Data.bytes, (size_t)p12Data.length);
     return output;
 }
 
+// Where resource hashes from previous signings of an app are kept; a fresh cache is fine if there is nowhere to keep one.
+static NSURL *HashesURL(NSString *bundleIdentifier)
+{
+    NSURL *cachesURL = [[NSFileManager defaultManager] URLForDirectory:NSCachesDirectory inDomain:NSUserDomainMask appropriateForURL:nil create:YES error:nil];
+    NSURL *hashesDirectoryURL = [(cachesURL ?: [[NSFileManager defaultManager] temporaryDirectory]) URLByAppendingPathComponent:(NSBundle.mainBundle.bundleIdentifier ?: @"AltSign") isDirectory:YES];
+    [[NSFileManager defaultManager] createDirectoryAtURL:hashesDirectoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+    return [hashesDirectoryURL URLByAppendingPathComponent:[NSString stringWithFormat:@"%@.hashes", bundleIdentifier]];
+}
+
+// Hands every file the signer is done with to a block, so it can be used while the rest of the app is still being signed.
+class ALTSignerFolder : public ldid::DiskFolder
+{
+public:
+    ALTSignerFolder(const std::string &path, ldid::HashCache &cache, void (^fileHandler)(NSString *, NSData *)) : ldid::DiskFolder(path, cache), fileHandler(fileHandler)
+    {
+    }
+    
+    virtual void Finish(const std::string &path, const ldid::Hash &hash)
+    {
+        if (fileHandler == nil)
+        {
+            return;
+        }
+        
+        // ldid calls this from its own threads, which have no autorelease pool of their own.
+        @autoreleasepool
+        {
+            NSString *relativePath = [NSString stringWithUTF8String:path.c_str()];
+            NSData *data = [NSData dataWithBytes:hash.sha256_ length:sizeof(hash.sha256_)];
+            fileHandler(relativePath, data);
+        }
+    }
+    
+private:
+    void (^fileHandler)(NSString *, NSData *);
+};
+
 @implementation ALTSigner
 
 + (void)load
@@ -97,48 +153,23 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
 
 - (NSProgress *)signAppAtURL:(NSURL *)appURL provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles completionHandler:(void (^)(BOOL success, NSError *error))completionHandler
 {
-    NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:1];
+    return [self signAppAtURL:appURL provisioningProfiles:profiles fileHandler:nil completionHandler:completionHandler];
+}
+
+- (NSProgress *)signAppAtURL:(NSURL *)appURL provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles fileHandler:(void (^)(NSString *relativePath, NSData *hash))fileHandler completionHandler:(void (^)(BOOL success, NSError *error))completionHandler
+{
+    if ([appURL.pathExtension.lowercaseString isEqualToString:@"ipa"])
+    {
+        return [self signIPAAtURL:appURL provisioningProfiles:profiles completionHandler:completionHandler];
+    }
     
-    NSURL *ipaURL = nil;
-    NSURL *appBundleURL = nil;
+    NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:1];
     
-    void (^finish)(BOOL, NSError *) = ^(BOOL success, NSError *error) {
-        if (ipaURL != nil)
-        {
-            NSError *removeError = nil;
-            if (![[NSFileManager defaultManager] removeItemAtURL:[ipaURL URLByDeletingLastPathComponent] error:&removeError])
-            {
-                NSLog(@"Failed to clean up after resigning. %@", removeError);
-            }
-        }
-        
-        completionHandler(success, error);
-    };
+    void (^finish)(BOOL, NSError *) = completionHandler;
     
     __block NSError *error = nil;
     
-    if ([appURL.pathExtension.lowercaseString isEqualToString:@"ipa"])
-    {
-        ipaURL = appURL;
-        
-        NSURL *outputDirectoryURL = [[appURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString] isDirectory:YES];
-        if (![[NSFileManager defaultManager] createDirectoryAtURL:outputDirectoryURL withIntermediateDirectories:YES attributes:nil error:&error])
-        {
-            finish(NO, error);
-            return progress;
-        }
-        
-        appBundleURL = [[NSFileManager defaultManager] unzipAppBundleAtURL:appURL toDirectory:outputDirectoryURL error:&error];
-        if (appBundleURL == nil)
-        {
-            finish(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorMissingAppBundle userInfo:@{NSUnderlyingErrorKey: error}]);
-            return progress;
-        }
-    }
-    else
-    {
-        appBundleURL = appURL;
-    }
+    NSURL *appBundleURL = appURL;
     
     NSBundle *appBundle = [NSBundle bundleWithURL:appBundleURL];
     if (appBundle == nil)
@@ -262,51 +293,228 @@ std::string CertificatesContent(ALTCertificate *altCertificate)
         }
         
         
-        // Sign application
-        ldid::DiskFolder appBundle(application.fileURL.fileSystemRepresentation);
-        std::string key = CertificatesContent(self.certificate);
+        // Reuse resource hashes from previous signings of this app.
+        NSURL *hashesURL = HashesURL(application.bundleIdentifier);
         
-        ldid::Sign("", appBundle, key, "",
-                   ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
-            NSString *filename = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
+        // Sign application
+        // The folder has to go away before we're done: that's when the files signing changed are written back.
+        {
+            ldid::HashCache hashCache(hashesURL.fileSystemRepresentation);
+            ALTSignerFolder appBundle(application.fileURL.fileSystemRepresentation, hashCache, fileHandler);
+            std::string key = CertificatesContent(self.certificate);
+            
+            ldid::Sign("", appBundle, key, "",
+                       ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
+                NSString *filename = [NSString stringWithCString:path.c_str() encoding:NSUTF8StringEncoding];
+                
+                NSURL *fileURL = nil;
+                
+                if (filename.length == 0)
+                {
+                    fileURL = application.fileURL;
+                }
+                else
+                {
+                    fileURL = [application.fileURL URLByAppendingPathComponent:filename isDirectory:YES];
+                }
+                
+                NSString *entitlements = entitlementsByFileURL[fileURL];
+                return (entitlements ?: @"").UTF8String;
+            }),
+                       ldid::fun([&](const std::string &string) {
+                progress.completedUnitCount += 1;
+            }),
+                       ldid::fun([&](const double signingProgress) {
+            }));
             
-            NSURL *fileURL = nil;
+            hashCache.Close();
+        }
+        
+        finish(YES, nil);
+    });
+
+    return progress;
+}
+
+- (NSProgress *)signIPAAtURL:(NSURL *)ipaURL provisioningProfiles:(NSArray<ALTProvisioningProfile *> *)profiles completionHandler:(void (^)(BOOL success, NSError *error))completionHandler
+{
+    NSProgress *progress = [NSProgress discreteProgressWithTotalUnitCount:1];
+    
+    // The signed app is written to a new archive next to the old one, which it then replaces.
+    NSURL *resignedIPAURL = [[ipaURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:[[[NSUUID UUID] UUIDString] stringByAppendingPathExtension:@"ipa"]];
+    
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSError *error = nil;
+        
+        try
+        {
+            // Find the one app in Payload/, and what it's called.
+            std::string prefix;
+            NSMutableData *mainInfoData = [NSMutableData data];
+            {
+                ldid::ZipReader archive(ipaURL.fileSystemRepresentation);
+                for (const auto &entry : archive.Entries())
+                {
+                    size_t slash = entry.name_.find('/', 8);
+                    if (entry.name_.compare(0, 8, "Payload/") != 0 || slash == std::string::npos || slash < 12 || entry.name_.compare(slash - 4, 4, ".app") != 0 || entry.name_.compare(slash + 1, std::string::npos, "Info.plist") != 0)
+                    {
+                        continue;
+                    }
+                    
+                    if (!prefix.empty())
+                    {
+                        completionHandler(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorInvalidApp userInfo:nil]);
+                        return;
+                    }
+                    
+                    prefix = entry.name_.substr(0, slash + 1);
+                    archive.Read(entry, ldid::fun([&](const void *data, size_t size) {
+                        [mainInfoData appendBytes:data length:size];
+                    }));
+                }
+            }
             
-            if (filename.length == 0)
+            if (prefix.empty())
             {
-                fileURL = application.fileURL;
+                completionHandler(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorMissingAppBundle userInfo:nil]);
+                return;
             }
-            else
+            
+            NSDictionary *mainInfoDictionary = [NSPropertyListSerialization propertyListWithData:mainInfoData options:0 format:nil error:nil];
+            NSString *mainBundleIdentifier = [mainInfoDictionary isKindOfClass:[NSDictionary class]] ? mainInfoDictionary[(NSString *)kCFBundleIdentifierKey] : nil;
+            if (![mainBundleIdentifier isKindOfClass:[NSString class]])
             {
-                fileURL = [application.fileURL URLByAppendingPathComponent:filename isDirectory:YES];
+                completionHandler(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorInvalidApp userInfo:nil]);
+                return;
             }
             
-            NSString *entitlements = entitlementsByFileURL[fileURL];
-            return (entitlements ?: @"").UTF8String;
-        }),
-                   ldid::fun([&](const std::string &string) {
-            progress.completedUnitCount += 1;
-        }),
-                   ldid::fun([&](const double signingProgress) {
-        }));
-        
-        
-        // Dispatch after to allow time to finish signing binary.
-        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-            if (ipaURL != nil)
+            // Reuse resource hashes from previous signings of this app, keyed by each entry's size, time and CRC.
+            ldid::HashCache hashCache(HashesURL(mainBundleIdentifier).fileSystemRepresentation);
+            ldid::ZipFolder folder(ipaURL.fileSystemRepresentation, prefix, resignedIPAURL.fileSystemRepresentation, hashCache);
+            
+            // The old signature is left out rather than carried along, as unzipping used to do.
+            folder.Remove("_CodeSignature/");
+            
+            auto infoDictionary = [&](const std::string &path) -> NSDictionary * {
+                if (!folder.Look(path + "Info.plist"))
+                {
+                    return nil;
+                }
+                
+                NSMutableData *data = [NSMutableData data];
+                folder.Open(path + "Info.plist", ldid::fun([&](std::streambuf &buffer, size_t length, const void *flag) {
+                    data.length = length;
+                    buffer.sgetn((char *)data.mutableBytes, length);
+                }));
+                
+                return [NSPropertyListSerialization propertyListWithData:data options:0 format:nil error:nil];
+            };
+            
+            // Bundles are keyed by their path in the app, which is how ldid asks for their entitlements.
+            std::vector<std::string> bundles;
+            bundles.push_back("");
+            
+            NSInteger totalCount = 0;
+            folder.Find("", ldid::fun([&](const std::string &name) {
+                size_t slash = name.find('/', 8);
+                if (name.compare(0, 8, "PlugIns/") == 0 && slash != std::string::npos && name.compare(slash + 1, std::string::npos, "Info.plist") == 0)
+                {
+                    bundles.push_back(name.substr(0, slash + 1));
+                }
+                
+                // Ignore CodeResources files.
+                if (name.size() < 13 || name.compare(name.size() - 13, 13, "CodeResources") != 0)
+                {
+                    totalCount++;
+                }
+            }), ldid::fun([&](const std::string &name, const ldid::Functor<std::string ()> &target) {
+                totalCount++;
+            }));
+            
+            progress.totalUnitCount = totalCount;
+            
+            std::map<std::string, std::string> entitlementsByPath;
+            
+            for (const auto &bundle : bundles)
             {
-                NSURL *resignedIPAURL = [[NSFileManager defaultManager] zipAppBundleAtURL:appBundleURL error:&error];
+                NSString *bundleIdentifier = infoDictionary(bundle)[(NSString *)kCFBundleIdentifierKey];
+                if (bundleIdentifier == nil)
+                {
+                    completionHandler(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorInvalidApp userInfo:nil]);
+                    return;
+                }
+                
+                ALTProvisioningProfile *profile = profiles.firstObject;
+                for (ALTProvisioningProfile *candidate in profiles)
+                {
+                    if ([candidate.bundleIdentifier isEqualToString:bundleIdentifier])
+                    {
+                        profile = candidate;
+                        break;
+                    }
+                }
+                
+                if (profile == nil)
+                {
+                    completionHandler(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorMissingProvisioningProfile userInfo:nil]);
+                    return;
+                }
+                
+                NSData *profileData = profile.data;
+                folder.Save(bundle + "embedded.mobileprovision", true, NULL, ldid::fun([&](std::streambuf &save) {
+                    save.sputn((const char *)profileData.bytes, profileData.length);
+                }));
                 
-                if (![[NSFileManager defaultManager] replaceItemAtURL:ipaURL withItemAtURL:resignedIPAURL backupItemName:nil options:0 resultingItemURL:nil error:&error])
+                NSData *entitlementsData = [NSPropertyListSerialization dataWithPropertyList:profile.entitlements format:NSPropertyListXMLFormat_v1_0 options:0 error:&error];
+                if (entitlementsData == nil)
                 {
-                    finish(NO, error);
+                    completionHandler(NO, error);
+                    return;
                 }
+                
+                entitlementsByPath[bundle] = std::string((const char *)entitlementsData.bytes, entitlementsData.length);
             }
             
-            finish(YES, nil);
-        });
-    });
+            std::string key = CertificatesContent(self.certificate);
+            
+            ldid::Sign("", folder, key, "",
+                       ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
+                auto entitlements = entitlementsByPath.find(path);
+                return entitlements == entitlementsByPath.end() ? "" : entitlements->second;
+            }),
+                       ldid::fun([&](const std::string &string) {
+                progress.completedUnitCount += 1;
+            }),
+                       ldid::fun([&](const double signingProgress) {
+            }));
+            
+            folder.Close();
+            hashCache.Close();
+        }
+        catch (const char *message)
+        {
+            [[NSFileManager defaultManager] removeItemAtURL:resignedIPAURL error:nil];
+            completionHandler(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorInvalidApp userInfo:@{NSLocalizedFailureReasonErrorKey: @(message)}]);
+            return;
+        }
+        catch (...)
+        {
+            // Anything else (running out of memory, a failed thread) must not get past this block either.
+            [[NSFileManager defaultManager] removeItemAtURL:resignedIPAURL error:nil];
+            completionHandler(NO, [NSError errorWithDomain:AltSignErrorDomain code:ALTErrorUnknown userInfo:nil]);
+            return;
+        }
 
+        if (![[NSFileManager defaultManager] replaceItemAtURL:ipaURL withItemAtURL:resignedIPAURL backupItemName:nil options:0 resultingItemURL:nil error:&error])
+        {
+            [[NSFileManager defaultManager] removeItemAtURL:resignedIPAURL error:nil];
+            completionHandler(NO, error);
+            return;
+        }
+        
+        completionHandler(YES, nil);
+    });
+    
     return progress;
 }
 
@@ -14,6 +14,8 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (nullable NSURL *)unzipAppBundleAtURL:(NSURL *)ipaURL toDirectory:(NSURL *)directoryURL error:(NSError **)error;
 - (nullable NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL error:(NSError **)error;
+// An uncompressed archive costs more to send, but nothing to build or to read back.
+- (nullable NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL compressed:(BOOL)compressed error:(NSError **)error;
 
 @end
 
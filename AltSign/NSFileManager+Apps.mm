@@ -0,0 +1,105 @@
+//
+//  NSFileManager+Apps.mm
+//  AltSign
+//
+//  Created by Riley Testut on 5/28/19.
+//  Copyright © 2019 Riley Testut. All rights reserved.
+//
+
+#import "NSFileManager+Apps.h"
+#import "NSError+ALTErrors.h"
+
+#include "ldid.hpp"
+
+#include <set>
+#include <string>
+
+#define READ_BUFFER_SIZE 8192
+#define MAX_FILENAME 512
+
+@implementation NSFileManager (Apps)
+
+- (nullable NSURL *)unzipAppBundleAtURL:(NSURL *)ipaURL toDirectory:(NSURL *)directoryURL error:(NSError **)error
+{
+	directoryURL = [directoryURL URLByAppendingPathExtension:@"app"];
+	[NSFileManager.defaultManager removeItemAtURL:directoryURL error:nil];
+	try {
+		ldid::ZipReader archive(ipaURL.fileSystemRepresentation);
+		BOOL hasPayload = NO;
+		std::set<std::string> apps;
+		for (const auto &entry : archive.Entries()) {
+			if (entry.name_.compare(0, 8, "Payload/") != 0) continue;
+			hasPayload = YES;
+			size_t slash = entry.name_.find('/', 8);
+			if (slash == std::string::npos) continue;
+			std::string name = entry.name_.substr(8, slash - 8);
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".app") == 0) apps.insert(name);
+		}
+		if (!hasPayload) {
+			if (error) *error = [NSError errorWithDomain:@"com.pixelomer.altdeploy.UnzipError" code:-2 userInfo:@{
+				NSLocalizedDescriptionKey : @"IPA does not contain a Payload directory."
+			}];
+			return nil;
+		}
+		if (apps.size() > 1) {
+			if (error) *error = [NSError errorWithDomain:@"com.pixelomer.altdeploy.UnzipError" code:-3 userInfo:@{
+				NSLocalizedDescriptionKey : @"Payload contains multiple applications."
+			}];
+			return nil;
+		}
+		if (apps.empty()) return directoryURL;
+		// The bundle is written straight to its destination, without the signature that is about to be replaced.
+		archive.Extract("Payload/" + *apps.begin() + "/", directoryURL.fileSystemRepresentation, ldid::fun([](const std::string &path) -> bool {
+			return path.compare(0, 15, "_CodeSignature/") != 0;
+		}));
+		return directoryURL;
+	}
+	catch (const char *message) {
+		[NSFileManager.defaultManager removeItemAtURL:directoryURL error:nil];
+		if (error) *error = [NSError errorWithDomain:@"com.pixelomer.altdeploy.UnzipError" code:-1 userInfo:@{
+			NSLocalizedDescriptionKey : @"Failed to extract the IPA.",
+			NSLocalizedFailureReasonErrorKey : @(message)
+		}];
+	}
+	catch (...) {
+		// Anything else (running out of memory, a failed thread) must not get past Objective-C either.
+		[NSFileManager.defaultManager removeItemAtURL:directoryURL error:nil];
+		if (error) *error = [NSError errorWithDomain:@"com.pixelomer.altdeploy.UnzipError" code:-1 userInfo:@{
+			NSLocalizedDescriptionKey : @"Failed to extract the IPA."
+		}];
+	}
+	return nil;
+}
+
+- (NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL error:(NSError **)error
+{
+	return [self zipAppBundleAtURL:appBundleURL compressed:YES error:error];
+}
+
+- (NSURL *)zipAppBundleAtURL:(NSURL *)appBundleURL compressed:(BOOL)compressed error:(NSError **)error
+{
+	NSURL *ipaURL = [NSURL fileURLWithPath:[[NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString] stringByAppendingPathExtension:@"ipa"]];
+	try {
+		// Entries are stored under Payload/ relative to the bundle, in a fixed order, with their files' modification times.
+		ldid::ZipWriter archive(ipaURL.fileSystemRepresentation, compressed ? -1 : 0);
+		archive.Add(std::string("Payload/") + appBundleURL.lastPathComponent.UTF8String, appBundleURL.fileSystemRepresentation);
+		archive.Close();
+		return ipaURL;
+	}
+	catch (const char *message) {
+		[NSFileManager.defaultManager removeItemAtURL:ipaURL error:nil];
+		if (error) *error = [NSError errorWithDomain:@"com.pixelomer.altdeploy.UnzipError" code:-1 userInfo:@{
+			NSLocalizedDescriptionKey : @"Failed to create the IPA.",
+			NSLocalizedFailureReasonErrorKey : @(message)
+		}];
+	}
+	catch (...) {
+		[NSFileManager.defaultManager removeItemAtURL:ipaURL error:nil];
+		if (error) *error = [NSError errorWithDomain:@"com.pixelomer.altdeploy.UnzipError" code:-1 userInfo:@{
+			NSLocalizedDescriptionKey : @"Failed to create the IPA."
+		}];
+	}
+	return nil;
+}
+
+@end
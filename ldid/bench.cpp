@@ -0,0 +1,548 @@
+/* ldid-bench - time code signing on synthetic Mach-O files and bundles
+ *
+ * Needs nothing but a host compiler, OpenSSL and libplist, so it runs on
+ * Linux without a device:
+ *
+ *   c++ -std=gnu++14 -O2 -o ldid-bench ldid/bench.cpp ldid/ldid.cpp -lcrypto -lplist-2.0 -lpthread -lz
+ *
+ *   ldid-bench binary --size 256M --arch fat --signed
+ *   ldid-bench bundle --files 20000 --file-size 16K --frameworks 30
+ *   ldid-bench unzip --ipa App.ipa
+ *   ldid-bench zip --dir App.app --level 0
+ *   ldid-bench ipa --files 2000 --frameworks 4
+ *
+ * ipa signs an archive of the synthetic bundle in place, once with an
+ * embedded.mobileprovision already in it and once without, saving a new one
+ * first as AltSign does, and checks every hash in the CodeResources of the
+ * archive it wrote against what that archive holds.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <ftw.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <openssl/sha.h>
+#include <plist/plist.h>
+
+#include "bench.hpp"
+#include "ldid.hpp"
+
+static const uint32_t ARM_ = 12;
+static const uint32_t ARM64_ = 0x0100000c;
+static const uint32_t ARMV7_ = 9;
+
+struct Options {
+    std::string mode_;
+    size_t size_ = 16 << 20;
+    std::string arch_ = "arm64";
+    bool signed_ = false;
+    std::string key_;
+    unsigned repeat_ = 3;
+    size_t files_ = 1000;
+    size_t file_ = 16 << 10;
+    size_t frameworks_ = 8;
+    std::string dir_;
+    std::string ipa_;
+    int level_ = -1;
+};
+
+static void usage() {
+    fprintf(stderr, "usage: ldid-bench binary [--size N] [--arch arm64|armv7|fat] [--signed] [--key p12] [--repeat N]\n");
+    fprintf(stderr, "       ldid-bench bundle [--size N] [--files N] [--file-size N] [--frameworks N] [--key p12] [--repeat N] [--dir path]\n");
+    fprintf(stderr, "       ldid-bench unzip --ipa path [--repeat N] [--dir path]\n");
+    fprintf(stderr, "       ldid-bench zip --dir path [--ipa path] [--level N] [--repeat N]\n");
+    fprintf(stderr, "       ldid-bench ipa [--size N] [--files N] [--file-size N] [--frameworks N] [--key p12] [--dir path]\n");
+    fprintf(stderr, "       sizes take K, M and G suffixes\n");
+    exit(1);
+}
+
+static size_t size(const char *value) {
+    size_t number;
+    if (!ParseSize(value, number))
+        usage();
+    return number;
+}
+
+static std::string read(const std::string &path) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "ldid-bench: cannot read %s\n", path.c_str());
+        exit(1);
+    }
+    std::stringstream data;
+    data << file.rdbuf();
+    return data.str();
+}
+
+static void write(const std::string &path, const std::string &data) {
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    if (!file) {
+        fprintf(stderr, "ldid-bench: cannot write %s\n", path.c_str());
+        exit(1);
+    }
+}
+
+static void mkdirs(const std::string &path) {
+    for (size_t slash(path.find('/', 1)); ; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+        if (slash == std::string::npos)
+            break;
+    }
+}
+
+static int Remove(const char *path, const struct stat *, int, struct FTW *) {
+    return remove(path);
+}
+
+/* Synthetic Content {{{ */
+static void fill(char *data, size_t size, uint64_t seed) {
+    uint64_t state(seed * 0x9e3779b97f4a7c15ULL + 1);
+    for (size_t i(0); i < size; i += sizeof(state)) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        memcpy(data + i, &state, std::min(sizeof(state), size - i));
+    }
+}
+
+template <typename Type_>
+static void append(std::string &data, const Type_ &value) {
+    data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void segment(std::string &commands, bool bits64, const char *name, uint64_t offset, uint64_t size) {
+    char segname[16] = {};
+    memcpy(segname, name, std::min(strlen(name), sizeof(segname)));
+    if (bits64) {
+        append(commands, uint32_t(0x19));
+        append(commands, uint32_t(72));
+        commands.append(segname, sizeof(segname));
+        for (uint64_t value : {offset, size, offset, size})
+            append(commands, value);
+    } else {
+        append(commands, uint32_t(0x1));
+        append(commands, uint32_t(56));
+        commands.append(segname, sizeof(segname));
+        for (uint64_t value : {offset, size, offset, size})
+            append(commands, uint32_t(value));
+    }
+    for (uint32_t value : {5, 5, 0, 0})
+        append(commands, value);
+}
+
+// a __TEXT segment of noise followed by a __LINKEDIT holding only a string table
+static std::string MachO(size_t size, bool bits64, uint64_t seed) {
+    size_t linkedit((size * 3 / 4) & ~size_t(0xfff));
+
+    std::string commands;
+    segment(commands, bits64, "__TEXT", 0, linkedit);
+    segment(commands, bits64, "__LINKEDIT", linkedit, size - linkedit);
+    for (uint32_t value : {uint32_t(0x2), uint32_t(24), uint32_t(linkedit), uint32_t(4), uint32_t(linkedit + 64), uint32_t(size - linkedit - 64)})
+        append(commands, value);
+
+    std::string data;
+    append(data, uint32_t(bits64 ? 0xfeedfacf : 0xfeedface));
+    append(data, bits64 ? ARM64_ : ARM_);
+    append(data, bits64 ? uint32_t(0) : ARMV7_);
+    for (uint32_t value : {uint32_t(2), uint32_t(3), uint32_t(commands.size()), uint32_t(0)})
+        append(data, value);
+    if (bits64)
+        append(data, uint32_t(0));
+    data += commands;
+
+    size_t header(data.size());
+    data.resize(size);
+    fill(&data[header], size - header, seed);
+    return data;
+}
+
+static uint32_t big(uint32_t value) {
+    return __builtin_bswap32(value);
+}
+
+static std::string Binary(size_t size, const std::string &arch, uint64_t seed) {
+    if (arch == "arm64")
+        return MachO(size, true, seed);
+    if (arch == "armv7")
+        return MachO(size, false, seed);
+    if (arch != "fat")
+        usage();
+
+    std::vector<std::pair<uint32_t, std::string>> slices;
+    slices.push_back(std::make_pair(ARM64_, MachO(size / 2, true, seed)));
+    slices.push_back(std::make_pair(ARM_, MachO(size / 2, false, seed + 1)));
+
+    std::string data;
+    append(data, big(0xcafebabe));
+    append(data, big(slices.size()));
+
+    uint32_t offset(0x4000);
+    std::vector<uint32_t> offsets;
+    for (const auto &slice : slices) {
+        offsets.push_back(offset);
+        for (uint32_t value : {slice.first, slice.first == ARM_ ? ARMV7_ : 0, offset, uint32_t(slice.second.size()), uint32_t(14)})
+            append(data, big(value));
+        offset = (offset + slice.second.size() + 0x3fff) & ~0x3fff;
+    }
+
+    for (size_t i(0); i != slices.size(); ++i) {
+        data.resize(offsets[i], '\0');
+        data += slices[i].second;
+    }
+
+    return data;
+}
+
+static std::string Plist(const std::string &executable, const std::string &identifier) {
+    return
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<plist version=\"1.0\"><dict>"
+        "<key>CFBundleExecutable</key><string>" + executable + "</string>"
+        "<key>CFBundleIdentifier</key><string>" + identifier + "</string>"
+        "</dict></plist>\n";
+}
+
+static void Bundle(const Options &options, const std::string &root) {
+    mkdirs(root);
+    write(root + "/Info.plist", Plist("Bench", "com.example.bench"));
+    write(root + "/Bench", Binary(options.size_, "arm64", 1));
+
+    for (size_t i(0); i != options.frameworks_; ++i) {
+        auto name("F" + std::to_string(i));
+        auto framework(root + "/Frameworks/" + name + ".framework");
+        mkdirs(framework);
+        write(framework + "/Info.plist", Plist(name, "com.example.bench." + name));
+        write(framework + "/" + name, Binary(std::max<size_t>(options.size_ / 16, 0x10000), "arm64", 100 + i));
+    }
+
+    std::string data(options.file_, '\0');
+    for (size_t i(0); i != options.files_; ++i) {
+        // a few hundred files per directory, like an asset-heavy app
+        auto directory(root + "/Assets/" + std::to_string(i / 256));
+        if (i % 256 == 0)
+            mkdirs(directory);
+        fill(&data[0], data.size(), 1000 + i);
+        write(directory + "/" + std::to_string(i) + ".bin", data);
+    }
+}
+/* }}} */
+
+/* Archive Checks {{{ */
+static std::string Contents(const ldid::ZipReader &archive, const std::string &name) {
+    for (const auto &entry : archive.Entries())
+        if (entry.name_ == name) {
+            std::string data;
+            archive.Read(entry, ldid::fun([&](const void *buffer, size_t size) {
+                data.append(static_cast<const char *>(buffer), size);
+            }));
+            return data;
+        }
+
+    fprintf(stderr, "ldid-bench: %s is not in the archive\n", name.c_str());
+    exit(1);
+}
+
+// whether each hash2 in the bundle's CodeResources is that of the file the archive holds, and the profile is the one saved
+static bool Check(const std::string &ipa, const std::string &root, const std::string &profile) {
+    ldid::ZipReader archive(ipa);
+    bool valid(true);
+
+    if (Contents(archive, root + "embedded.mobileprovision") != profile) {
+        fprintf(stderr, "ldid-bench: the archive holds the wrong embedded.mobileprovision\n");
+        valid = false;
+    }
+
+    auto resources(Contents(archive, root + "_CodeSignature/CodeResources"));
+    plist_t plist(NULL);
+    plist_from_xml(resources.data(), resources.size(), &plist);
+    auto files(plist == NULL ? NULL : plist_dict_get_item(plist, "files2"));
+    if (files == NULL) {
+        fprintf(stderr, "ldid-bench: CodeResources has no files2\n");
+        plist_free(plist);
+        return false;
+    }
+
+    if (plist_dict_get_item(files, "embedded.mobileprovision") == NULL) {
+        fprintf(stderr, "ldid-bench: embedded.mobileprovision is not sealed\n");
+        valid = false;
+    }
+
+    plist_dict_iter iterator(NULL);
+    plist_dict_new_iter(files, &iterator);
+    for (;;) {
+        char *key(NULL);
+        plist_t entry(NULL);
+        plist_dict_next_item(files, iterator, &key, &entry);
+        if (key == NULL)
+            break;
+        std::string name(key);
+        free(key);
+
+        auto hash2(plist_dict_get_item(entry, "hash2"));
+        if (hash2 == NULL)
+            continue;
+
+        char *expected(NULL);
+        uint64_t length(0);
+        plist_get_data_val(hash2, &expected, &length);
+
+        auto data(Contents(archive, root + name));
+        uint8_t actual[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const uint8_t *>(data.data()), data.size(), actual);
+
+        if (length != sizeof(actual) || memcmp(expected, actual, sizeof(actual)) != 0) {
+            fprintf(stderr, "ldid-bench: CodeResources has the wrong hash for %s\n", name.c_str());
+            valid = false;
+        }
+
+        free(expected);
+    }
+
+    free(iterator);
+    plist_free(plist);
+    return valid;
+}
+/* }}} */
+
+static void report(unsigned run, double total) {
+    static const char *names[ldid::PhaseCount] = {"allocate", "page-hash", "cms", "resources", "plist"};
+    printf("run %u: %.3fs", run, total);
+    for (size_t i(0); i != ldid::PhaseCount; ++i)
+        printf("  %s %.3fs", names[i], ldid::GetPhase(ldid::Phase(i)));
+    static const char *transfers[ldid::TransferCount] = {"cloned", "kernel", "memcpy"};
+    for (size_t i(0); i != ldid::TransferCount; ++i)
+        if (auto bytes = ldid::GetTransfer(ldid::Transfer(i)))
+            printf("  %s %.1fM", transfers[i], bytes / 1048576.0);
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2)
+        usage();
+
+    Options options;
+    options.mode_ = argv[1];
+
+    for (int i(2); i != argc; ++i) {
+        std::string flag(argv[i]);
+        if (flag == "--signed") {
+            options.signed_ = true;
+            continue;
+        }
+
+        if (i + 1 == argc)
+            usage();
+        const char *value(argv[++i]);
+
+        if (flag == "--size")
+            options.size_ = size(value);
+        else if (flag == "--arch")
+            options.arch_ = value;
+        else if (flag == "--key")
+            options.key_ = read(value);
+        else if (flag == "--repeat")
+            options.repeat_ = strtoul(value, NULL, 0);
+        else if (flag == "--files")
+            options.files_ = strtoull(value, NULL, 0);
+        else if (flag == "--file-size")
+            options.file_ = size(value);
+        else if (flag == "--frameworks")
+            options.frameworks_ = strtoull(value, NULL, 0);
+        else if (flag == "--dir")
+            options.dir_ = value;
+        else if (flag == "--ipa")
+            options.ipa_ = value;
+        else if (flag == "--level")
+            options.level_ = strtol(value, NULL, 0);
+        else
+            usage();
+    }
+
+    auto nothing(ldid::fun([](double) {}));
+
+    if (options.mode_ == "binary") {
+        auto input(Binary(options.size_, options.arch_, 1));
+
+        if (options.signed_) {
+            std::stringbuf output;
+            ldid::Sign(input.data(), input.size(), output, "com.example.bench", "", "", options.key_, ldid::Slots(), nothing);
+            input = output.str();
+        }
+
+        // the signer may read up to 16 bytes past the end, as it does when a bundle hands it a file
+        input.append(16, '\0');
+
+        printf("binary: %zu bytes, %s%s\n", input.size() - 16, options.arch_.c_str(), options.signed_ ? ", already signed" : "");
+        for (unsigned run(0); run != options.repeat_; ++run) {
+            ldid::ResetPhases();
+            std::stringbuf output;
+            auto start(now());
+            ldid::Sign(input.data(), input.size() - 16, output, "com.example.bench", "", "", options.key_, ldid::Slots(), nothing);
+            report(run, now() - start);
+        }
+    } else if (options.mode_ == "bundle") {
+        auto temporary(options.dir_.empty());
+        if (temporary) {
+            char path[] = "/tmp/ldid-bench.XXXXXX";
+            if (mkdtemp(path) == NULL) {
+                fprintf(stderr, "ldid-bench: mkdtemp failed\n");
+                return 1;
+            }
+            options.dir_ = path;
+        }
+
+        printf("bundle: %zu files of %zu bytes, %zu frameworks, %zu byte executable\n", options.files_, options.file_, options.frameworks_, options.size_);
+        for (unsigned run(0); run != options.repeat_; ++run) {
+            auto root(options.dir_ + "/Bench.app");
+            // an already signed bundle is kept, so later runs measure re-signing it
+            if (!options.signed_ || run == 0) {
+                nftw(root.c_str(), &Remove, 64, FTW_DEPTH | FTW_PHYS);
+                Bundle(options, root);
+            }
+
+            ldid::ResetPhases();
+            auto start(now());
+            {
+                ldid::DiskFolder folder(root);
+                ldid::Sign("", folder, options.key_, "", ldid::fun([](const std::string &, const std::string &entitlements) -> std::string {
+                    return entitlements;
+                }), ldid::fun([](const std::string &) {}), nothing);
+            }
+            report(run, now() - start);
+        }
+
+        if (temporary)
+            nftw(options.dir_.c_str(), &Remove, 64, FTW_DEPTH | FTW_PHYS);
+    } else if (options.mode_ == "unzip") {
+        if (options.ipa_.empty())
+            usage();
+
+        auto temporary(options.dir_.empty());
+        if (temporary) {
+            char path[] = "/tmp/ldid-bench.XXXXXX";
+            if (mkdtemp(path) == NULL) {
+                fprintf(stderr, "ldid-bench: mkdtemp failed\n");
+                return 1;
+            }
+            options.dir_ = path;
+        }
+
+        for (unsigned run(0); run != options.repeat_; ++run) {
+            auto root(options.dir_ + "/Payload");
+            nftw(root.c_str(), &Remove, 64, FTW_DEPTH | FTW_PHYS);
+
+            ldid::ResetPhases();
+            auto start(now());
+            ldid::ZipReader archive(options.ipa_);
+            archive.Extract("Payload/", root, ldid::fun([](const std::string &) {
+                return true;
+            }));
+            auto total(now() - start);
+
+            if (run == 0)
+                printf("unzip: %zu entries\n", archive.Entries().size());
+            report(run, total);
+        }
+
+        if (temporary)
+            nftw(options.dir_.c_str(), &Remove, 64, FTW_DEPTH | FTW_PHYS);
+    } else if (options.mode_ == "zip") {
+        if (options.dir_.empty())
+            usage();
+
+        auto temporary(options.ipa_.empty());
+        if (temporary)
+            options.ipa_ = "/tmp/ldid-bench." + std::to_string(getpid()) + ".ipa";
+
+        auto name(options.dir_.substr(options.dir_.rfind('/') + 1));
+        for (unsigned run(0); run != options.repeat_; ++run) {
+            ldid::ResetPhases();
+            auto start(now());
+            ldid::ZipWriter archive(options.ipa_, options.level_);
+            archive.Add("Payload/" + name, options.dir_);
+            archive.Close();
+            auto total(now() - start);
+
+            if (run == 0) {
+                struct stat info;
+                stat(options.ipa_.c_str(), &info);
+                printf("zip: %lld bytes\n", (long long) info.st_size);
+            }
+            report(run, total);
+        }
+
+        if (temporary)
+            unlink(options.ipa_.c_str());
+    } else if (options.mode_ == "ipa") {
+        auto temporary(options.dir_.empty());
+        if (temporary) {
+            char path[] = "/tmp/ldid-bench.XXXXXX";
+            if (mkdtemp(path) == NULL) {
+                fprintf(stderr, "ldid-bench: mkdtemp failed\n");
+                return 1;
+            }
+            options.dir_ = path;
+        }
+
+        printf("ipa: %zu files of %zu bytes, %zu frameworks, %zu byte executable\n", options.files_, options.file_, options.frameworks_, options.size_);
+
+        bool valid(true);
+        std::string profile("a provisioning profile\n");
+
+        for (bool existing : {true, false}) {
+            auto root(options.dir_ + "/Bench.app");
+            auto input(options.dir_ + "/Bench.ipa");
+            auto output(options.dir_ + "/Signed.ipa");
+
+            nftw(root.c_str(), &Remove, 64, FTW_DEPTH | FTW_PHYS);
+            Bundle(options, root);
+            if (existing)
+                write(root + "/embedded.mobileprovision", "an older profile\n");
+
+            {
+                ldid::ZipWriter archive(input);
+                archive.Add("Payload/Bench.app", root);
+                archive.Close();
+            }
+
+            ldid::ResetPhases();
+            auto start(now());
+            {
+                ldid::ZipFolder folder(input, "Payload/Bench.app/", output);
+                folder.Save("embedded.mobileprovision", true, NULL, ldid::fun([&](std::streambuf &save) {
+                    save.sputn(profile.data(), profile.size());
+                }));
+                ldid::Sign("", folder, options.key_, "", ldid::fun([](const std::string &, const std::string &entitlements) -> std::string {
+                    return entitlements;
+                }), ldid::fun([](const std::string &) {}), nothing);
+                folder.Close();
+            }
+            auto total(now() - start);
+
+            printf("%s profile: ", existing ? "existing" : "new     ");
+            report(0, total);
+
+            valid = Check(output, "Payload/Bench.app/", profile) && valid;
+        }
+
+        if (temporary)
+            nftw(options.dir_.c_str(), &Remove, 64, FTW_DEPTH | FTW_PHYS);
+
+        return valid ? 0 : 1;
+    } else
+        usage();
+
+    return 0;
+}
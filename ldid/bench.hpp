@@ -0,0 +1,28 @@
+/* helpers shared by ldid-bench (ldid/bench.cpp) and altserver-bench (AltServer/bench.cpp) */
+
+#ifndef LDID_BENCH_HPP
+#define LDID_BENCH_HPP
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+// a byte count, optionally followed by K, M or G; false if value isn't one
+static bool ParseSize(const char *value, size_t &number) {
+    static const char suffixes[] = "KMG";
+    char *end;
+    number = strtoull(value, &end, 0);
+    if (*end == '\0')
+        return true;
+    auto suffix(strchr(suffixes, *end));
+    if (suffix == NULL || end[1] != '\0')
+        return false;
+    number <<= 10 * (suffix - suffixes + 1);
+    return true;
+}
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif//LDID_BENCH_HPP
@@ -19,15 +19,25 @@
 **/
 /* }}} */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <dirent.h>
@@ -40,8 +50,16 @@
 
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include <zlib.h>
+
 #ifndef LDID_NOSMIME
 #include <openssl/err.h>
 #include <openssl/pem.h>
@@ -494,7 +512,7 @@ static inline void put(std::streambuf &stream, const void *data, size_t size) {
 static inline void put(std::streambuf &stream, const void *data, size_t size, const ldid::Functor<void (double)> &percent) {
     percent(0);
     for (size_t total(0); total != size;) {
-        auto writ(std::min(size - total, size_t(4096 * 4)));
+        auto writ(std::min(size - total, size_t(1 << 20)));
         _assert(stream.sputn(static_cast<const char *>(data) + total, writ) == writ);
         total += writ;
         percent(double(total) / size);
@@ -511,9 +529,121 @@ static size_t most(std::streambuf &stream, void *data, size_t size) {
 }
 
 static inline void pad(std::streambuf &stream, size_t size) {
-    char padding[size];
-    memset(padding, 0, size);
-    put(stream, padding, size);
+    static const char padding[0x4000] = {};
+    for (size_t writ; size != 0; size -= writ) {
+        writ = std::min(size, sizeof(padding));
+        put(stream, padding, writ);
+    }
+}
+
+// XXX: hardware_concurrency() is allowed to return 0
+static const unsigned Cores_(std::max(1u, std::thread::hardware_concurrency()));
+static std::atomic<unsigned> spawned_(0);
+
+// the calling thread always participates, so nested calls (bundles within bundles) cannot deadlock
+// waiting on each other; spawned_ caps the number of extra threads alive across all of those calls
+static void Parallel(size_t count, const ldid::Functor<void (size_t)> &code) {
+    std::atomic<size_t> next(0);
+
+    std::mutex mutex;
+    std::exception_ptr error;
+
+    auto work([&]() {
+        for (;;) {
+            size_t index(next++);
+            if (index >= count)
+                break;
+#ifdef __EXCEPTIONS
+            try {
+                code(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                next = count;
+            }
+#else
+            code(index);
+#endif
+        }
+    });
+
+    std::vector<std::thread> threads;
+    while (threads.size() + 1 < count) {
+        auto spawned(spawned_.load());
+        if (spawned + 1 >= Cores_)
+            break;
+        if (spawned_.compare_exchange_weak(spawned, spawned + 1))
+            threads.emplace_back(work);
+    }
+
+    work();
+
+    for (auto &thread : threads)
+        thread.join();
+    spawned_ -= threads.size();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+static std::atomic<uint64_t> phases_[ldid::PhaseCount];
+static std::atomic<uint64_t> transfers_[ldid::TransferCount];
+
+// phases nest exclusively: while an inner phase runs on a thread, the one it interrupted is not charged
+class Timer {
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    static thread_local Timer *current_;
+
+    ldid::Phase phase_;
+    Timer *outer_;
+    Clock::time_point start_;
+
+    void Charge(Clock::time_point now) {
+        phases_[phase_] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_).count();
+    }
+
+  public:
+    Timer(ldid::Phase phase) :
+        phase_(phase),
+        outer_(current_),
+        start_(Clock::now())
+    {
+        if (outer_ != NULL)
+            outer_->Charge(start_);
+        current_ = this;
+    }
+
+    ~Timer() {
+        auto now(Clock::now());
+        Charge(now);
+        current_ = outer_;
+        if (outer_ != NULL)
+            outer_->start_ = now;
+    }
+};
+
+thread_local Timer *Timer::current_(NULL);
+
+namespace ldid {
+
+void ResetPhases() {
+    for (auto &phase : phases_)
+        phase = 0;
+    for (auto &transfer : transfers_)
+        transfer = 0;
+}
+
+double GetPhase(Phase phase) {
+    return phases_[phase] / 1e9;
+}
+
+uint64_t GetTransfer(Transfer transfer) {
+    return transfers_[transfer];
+}
+
 }
 
 template <typename Type_>
@@ -867,6 +997,403 @@ struct CodeDirectory {
 extern "C" uint32_t hash(uint8_t *k, uint32_t length, uint32_t initval);
 #endif
 
+static void PagesSHA1(uint8_t *hashes, const uint8_t *data, size_t count) {
+    for (size_t i(0); i != count; ++i)
+        LDID_SHA1(data + i * PageSize_, PageSize_, hashes + i * LDID_SHA1_DIGEST_LENGTH);
+}
+
+static void PagesSHA256(uint8_t *hashes, const uint8_t *data, size_t count) {
+    for (size_t i(0); i != count; ++i)
+        LDID_SHA256(data + i * PageSize_, PageSize_, hashes + i * LDID_SHA256_DIGEST_LENGTH);
+}
+
+#ifdef __x86_64__
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* x86_64 Page Kernels {{{ */
+// every page is exactly PageSize_ bytes, so the final padding block is a constant that is never loaded from memory
+
+static const uint32_t SHA1Initial_[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static const uint32_t SHA256Initial_[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t SHA256Rounds_[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void Store(uint8_t *hash, const uint32_t *state, size_t words) {
+    for (size_t i(0); i != words; ++i) {
+        hash[i * 4 + 0] = state[i] >> 24;
+        hash[i * 4 + 1] = state[i] >> 16;
+        hash[i * 4 + 2] = state[i] >> 8;
+        hash[i * 4 + 3] = state[i];
+    }
+}
+
+/* AVX2: Eight Pages per Call {{{ */
+#define _avx2 \
+    __attribute__((__target__("avx2")))
+
+_avx2 static inline __m256i Rotate(__m256i value, int bits) {
+    return _mm256_or_si256(_mm256_slli_epi32(value, bits), _mm256_srli_epi32(value, 32 - bits));
+}
+
+// loads eight big-endian words from each of eight pages and transposes them so vector i holds word i of every page
+_avx2 static inline void Transpose(__m256i *words, const uint8_t *data) {
+    const __m256i swap(_mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3));
+
+    __m256i rows[8];
+    for (size_t i(0); i != 8; ++i)
+        rows[i] = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i * PageSize_)), swap);
+
+    __m256i pairs[8];
+    for (size_t i(0); i != 8; i += 4) {
+        pairs[i + 0] = _mm256_unpacklo_epi32(rows[i + 0], rows[i + 1]);
+        pairs[i + 1] = _mm256_unpackhi_epi32(rows[i + 0], rows[i + 1]);
+        pairs[i + 2] = _mm256_unpacklo_epi32(rows[i + 2], rows[i + 3]);
+        pairs[i + 3] = _mm256_unpackhi_epi32(rows[i + 2], rows[i + 3]);
+    }
+
+    __m256i quads[8];
+    for (size_t i(0); i != 8; i += 4) {
+        quads[i + 0] = _mm256_unpacklo_epi64(pairs[i + 0], pairs[i + 2]);
+        quads[i + 1] = _mm256_unpackhi_epi64(pairs[i + 0], pairs[i + 2]);
+        quads[i + 2] = _mm256_unpacklo_epi64(pairs[i + 1], pairs[i + 3]);
+        quads[i + 3] = _mm256_unpackhi_epi64(pairs[i + 1], pairs[i + 3]);
+    }
+
+    for (size_t i(0); i != 4; ++i) {
+        words[i + 0] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x20);
+        words[i + 4] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x31);
+    }
+}
+
+_avx2 static void Extract(uint8_t *hashes, const __m256i *state, size_t words, size_t size) {
+    uint32_t lanes[8][8];
+    for (size_t i(0); i != words; ++i)
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[i]), state[i]);
+
+    for (size_t lane(0); lane != 8; ++lane) {
+        uint32_t digest[8];
+        for (size_t i(0); i != words; ++i)
+            digest[i] = lanes[i][lane];
+        Store(hashes + lane * size, digest, words);
+    }
+}
+
+_avx2 static void SHA1Block(__m256i *state, const __m256i *block) {
+    __m256i w[16];
+    for (size_t i(0); i != 16; ++i)
+        w[i] = block[i];
+
+    __m256i a(state[0]), b(state[1]), c(state[2]), d(state[3]), e(state[4]);
+
+    for (size_t t(0); t != 80; ++t) {
+        if (t >= 16)
+            w[t & 15] = Rotate(_mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]), _mm256_xor_si256(w[(t - 14) & 15], w[t & 15])), 1);
+
+        __m256i f, k;
+        if (t < 20) {
+            f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+            k = _mm256_set1_epi32(0x5a827999);
+        } else if (t < 40) {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(0x6ed9eba1);
+        } else if (t < 60) {
+            f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+            k = _mm256_set1_epi32(0x8f1bbcdc);
+        } else {
+            f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+            k = _mm256_set1_epi32(0xca62c1d6);
+        }
+
+        __m256i temp(_mm256_add_epi32(_mm256_add_epi32(Rotate(a, 5), f), _mm256_add_epi32(_mm256_add_epi32(e, k), w[t & 15])));
+        e = d;
+        d = c;
+        c = Rotate(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] = _mm256_add_epi32(state[0], a);
+    state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c);
+    state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e);
+}
+
+_avx2 static void SHA256Block(__m256i *state, const __m256i *block) {
+    __m256i w[16];
+    for (size_t i(0); i != 16; ++i)
+        w[i] = block[i];
+
+    __m256i a(state[0]), b(state[1]), c(state[2]), d(state[3]), e(state[4]), f(state[5]), g(state[6]), h(state[7]);
+
+    for (size_t t(0); t != 64; ++t) {
+        if (t >= 16) {
+            auto &w2(w[(t - 2) & 15]), &w15(w[(t - 15) & 15]);
+            auto s0(_mm256_xor_si256(_mm256_xor_si256(Rotate(w15, 25), Rotate(w15, 14)), _mm256_srli_epi32(w15, 3)));
+            auto s1(_mm256_xor_si256(_mm256_xor_si256(Rotate(w2, 15), Rotate(w2, 13)), _mm256_srli_epi32(w2, 10)));
+            w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+        }
+
+        auto S1(_mm256_xor_si256(_mm256_xor_si256(Rotate(e, 26), Rotate(e, 21)), Rotate(e, 7)));
+        auto ch(_mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)));
+        auto t1(_mm256_add_epi32(_mm256_add_epi32(h, S1), _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32(SHA256Rounds_[t])), w[t & 15])));
+
+        auto S0(_mm256_xor_si256(_mm256_xor_si256(Rotate(a, 30), Rotate(a, 19)), Rotate(a, 10)));
+        auto maj(_mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b))));
+        auto t2(_mm256_add_epi32(S0, maj));
+
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    state[0] = _mm256_add_epi32(state[0], a);
+    state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c);
+    state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e);
+    state[5] = _mm256_add_epi32(state[5], f);
+    state[6] = _mm256_add_epi32(state[6], g);
+    state[7] = _mm256_add_epi32(state[7], h);
+}
+
+template <size_t Words_, size_t Size_, void (*Block_)(__m256i *, const __m256i *), void (*Scalar_)(uint8_t *, const uint8_t *, size_t)>
+_avx2 static void PagesAVX2(uint8_t *hashes, const uint8_t *data, size_t count, const uint32_t *initial) {
+    __m256i padding[16];
+    padding[0] = _mm256_set1_epi32(0x80000000);
+    for (size_t i(1); i != 15; ++i)
+        padding[i] = _mm256_setzero_si256();
+    padding[15] = _mm256_set1_epi32(PageSize_ * 8);
+
+    size_t batch(count & ~size_t(7));
+    for (size_t page(0); page != batch; page += 8) {
+        auto base(data + page * PageSize_);
+
+        __m256i state[Words_];
+        for (size_t i(0); i != Words_; ++i)
+            state[i] = _mm256_set1_epi32(initial[i]);
+
+        for (size_t offset(0); offset != PageSize_; offset += 64) {
+            __m256i block[16];
+            Transpose(block + 0, base + offset + 0);
+            Transpose(block + 8, base + offset + 32);
+            Block_(state, block);
+        }
+
+        Block_(state, padding);
+        Extract(hashes + page * Size_, state, Words_, Size_);
+    }
+
+    Scalar_(hashes + batch * Size_, data + batch * PageSize_, count - batch);
+}
+
+_avx2 static void PagesSHA1AVX2(uint8_t *hashes, const uint8_t *data, size_t count) {
+    PagesAVX2<5, LDID_SHA1_DIGEST_LENGTH, &SHA1Block, &PagesSHA1>(hashes, data, count, SHA1Initial_);
+}
+
+_avx2 static void PagesSHA256AVX2(uint8_t *hashes, const uint8_t *data, size_t count) {
+    PagesAVX2<8, LDID_SHA256_DIGEST_LENGTH, &SHA256Block, &PagesSHA256>(hashes, data, count, SHA256Initial_);
+}
+/* }}} */
+/* SHA Extensions: One Page at a Time {{{ */
+#define _shani \
+    __attribute__((__target__("sha,sse4.1")))
+
+_shani static void PagesSHA1SHANI(uint8_t *hashes, const uint8_t *data, size_t count) {
+    const __m128i swap(_mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL));
+
+    __m128i padding[4];
+    padding[0] = _mm_set_epi32(0x80000000, 0, 0, 0);
+    padding[1] = _mm_setzero_si128();
+    padding[2] = _mm_setzero_si128();
+    padding[3] = _mm_set_epi32(0, 0, 0, PageSize_ * 8);
+
+    for (size_t page(0); page != count; ++page) {
+        __m128i abcd(_mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA1Initial_)), 0x1b));
+        __m128i e0(_mm_set_epi32(SHA1Initial_[4], 0, 0, 0));
+
+        for (size_t offset(0); offset <= PageSize_; offset += 64) {
+            __m128i msg[4];
+            for (size_t i(0); i != 4; ++i)
+                msg[i] = offset == PageSize_ ? padding[i] : _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + page * PageSize_ + offset + i * 16)), swap);
+
+            __m128i save(abcd), esave(e0), e1;
+
+            // the rounds take their function selector as an immediate, hence the switch
+#define _rounds(e, group) \
+    switch ((group) / 5) { \
+        case 0: abcd = _mm_sha1rnds4_epu32(abcd, e, 0); break; \
+        case 1: abcd = _mm_sha1rnds4_epu32(abcd, e, 1); break; \
+        case 2: abcd = _mm_sha1rnds4_epu32(abcd, e, 2); break; \
+        default: abcd = _mm_sha1rnds4_epu32(abcd, e, 3); break; \
+    }
+
+            for (size_t i(0); i != 20; ++i) {
+                auto &current(msg[i & 3]);
+                auto &next(i & 1 ? e1 : e0), &other(i & 1 ? e0 : e1);
+
+                if (i == 0)
+                    next = _mm_add_epi32(next, current);
+                else
+                    next = _mm_sha1nexte_epu32(next, current);
+                other = abcd;
+
+                if (i >= 3 && i <= 18)
+                    msg[(i + 1) & 3] = _mm_sha1msg2_epu32(msg[(i + 1) & 3], current);
+                _rounds(next, i)
+                if (i >= 1 && i <= 16)
+                    msg[(i + 3) & 3] = _mm_sha1msg1_epu32(msg[(i + 3) & 3], current);
+                if (i >= 2 && i <= 17)
+                    msg[(i + 2) & 3] = _mm_xor_si128(msg[(i + 2) & 3], current);
+            }
+
+#undef _rounds
+
+            e0 = _mm_sha1nexte_epu32(e0, esave);
+            abcd = _mm_add_epi32(abcd, save);
+        }
+
+        uint32_t state[5];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1b));
+        state[4] = _mm_extract_epi32(e0, 3);
+        Store(hashes + page * LDID_SHA1_DIGEST_LENGTH, state, 5);
+    }
+}
+
+_shani static void PagesSHA256SHANI(uint8_t *hashes, const uint8_t *data, size_t count) {
+    const __m128i swap(_mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL));
+
+    __m128i padding[4];
+    padding[0] = _mm_set_epi32(0, 0, 0, 0x80000000);
+    padding[1] = _mm_setzero_si128();
+    padding[2] = _mm_setzero_si128();
+    padding[3] = _mm_set_epi32(PageSize_ * 8, 0, 0, 0);
+
+    for (size_t page(0); page != count; ++page) {
+        __m128i temp(_mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256Initial_ + 0)), 0xb1));
+        __m128i state1(_mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256Initial_ + 4)), 0x1b));
+        __m128i state0(_mm_alignr_epi8(temp, state1, 8));
+        state1 = _mm_blend_epi16(state1, temp, 0xf0);
+
+        for (size_t offset(0); offset <= PageSize_; offset += 64) {
+            __m128i msg[4];
+            for (size_t i(0); i != 4; ++i)
+                msg[i] = offset == PageSize_ ? padding[i] : _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + page * PageSize_ + offset + i * 16)), swap);
+
+            __m128i save0(state0), save1(state1);
+
+            for (size_t i(0); i != 16; ++i) {
+                auto &current(msg[i & 3]);
+
+                auto work(_mm_add_epi32(current, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256Rounds_ + i * 4))));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, work);
+
+                if (i >= 3 && i <= 14) {
+                    auto &next(msg[(i + 1) & 3]);
+                    next = _mm_add_epi32(next, _mm_alignr_epi8(current, msg[(i + 3) & 3], 4));
+                    next = _mm_sha256msg2_epu32(next, current);
+                }
+
+                state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(work, 0x0e));
+
+                if (i >= 1 && i <= 12)
+                    msg[(i + 3) & 3] = _mm_sha256msg1_epu32(msg[(i + 3) & 3], current);
+            }
+
+            state0 = _mm_add_epi32(state0, save0);
+            state1 = _mm_add_epi32(state1, save1);
+        }
+
+        temp = _mm_shuffle_epi32(state0, 0x1b);
+        state1 = _mm_shuffle_epi32(state1, 0xb1);
+
+        uint32_t state[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 0), _mm_blend_epi16(temp, state1, 0xf0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), _mm_alignr_epi8(state1, temp, 8));
+        Store(hashes + page * LDID_SHA256_DIGEST_LENGTH, state, 8);
+    }
+}
+/* }}} */
+
+struct Features {
+    bool avx2_;
+    bool sha_;
+
+    Features() :
+        avx2_(false),
+        sha_(false)
+    {
+        unsigned eax, ebx, ecx, edx;
+        if (__get_cpuid_max(0, NULL) < 7)
+            return;
+
+        __cpuid(1, eax, ebx, ecx, edx);
+        bool ssse3((ecx & bit_SSSE3) != 0), sse41((ecx & bit_SSE4_1) != 0);
+        // the kernel has to save the ymm registers too, not just support the instructions
+        bool ymm(false);
+        if ((ecx & bit_OSXSAVE) != 0) {
+            uint32_t low, high;
+            __asm__ ("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+            ymm = (low & 0x6) == 0x6;
+        }
+
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        avx2_ = ymm && (ebx & bit_AVX2) != 0;
+        sha_ = ssse3 && sse41 && (ebx & bit_SHA) != 0;
+    }
+};
+
+static const Features &GetFeatures() {
+    static Features features;
+    return features;
+}
+/* }}} */
+#endif
+
+typedef void (*PagesFunction)(uint8_t *, const uint8_t *, size_t);
+
+static PagesFunction GetPagesSHA1() {
+#ifdef __x86_64__
+    if (GetFeatures().sha_)
+        return &PagesSHA1SHANI;
+    if (GetFeatures().avx2_)
+        return &PagesSHA1AVX2;
+#endif
+    return &PagesSHA1;
+}
+
+static PagesFunction GetPagesSHA256() {
+#ifdef __x86_64__
+    if (GetFeatures().sha_)
+        return &PagesSHA256SHANI;
+    if (GetFeatures().avx2_)
+        return &PagesSHA256AVX2;
+#endif
+    return &PagesSHA256;
+}
+
 struct Algorithm {
     size_t size_;
     uint8_t type_;
@@ -882,6 +1409,9 @@ struct Algorithm {
     virtual void operator ()(uint8_t *hash, const void *data, size_t size) const = 0;
     virtual void operator ()(ldid::Hash &hash, const void *data, size_t size) const = 0;
     virtual void operator ()(std::vector<char> &hash, const void *data, size_t size) const = 0;
+
+    // hashes count whole pages laid out back to back, one hash per page
+    virtual void Pages(uint8_t *hashes, const void *data, size_t count) const = 0;
 };
 
 struct AlgorithmSHA1 :
@@ -908,6 +1438,11 @@ struct AlgorithmSHA1 :
         hash.resize(LDID_SHA1_DIGEST_LENGTH);
         return operator ()(reinterpret_cast<uint8_t *>(hash.data()), data, size);
     }
+
+    void Pages(uint8_t *hashes, const void *data, size_t count) const {
+        static const PagesFunction pages(GetPagesSHA1());
+        return pages(hashes, static_cast<const uint8_t *>(data), count);
+    }
 };
 
 struct AlgorithmSHA256 :
@@ -934,6 +1469,11 @@ struct AlgorithmSHA256 :
         hash.resize(LDID_SHA256_DIGEST_LENGTH);
         return operator ()(reinterpret_cast<uint8_t *>(hash.data()), data, size);
     }
+
+    void Pages(uint8_t *hashes, const void *data, size_t count) const {
+        static const PagesFunction pages(GetPagesSHA256());
+        return pages(hashes, static_cast<const uint8_t *>(data), count);
+    }
 };
 
 static const std::vector<Algorithm *> &GetAlgorithms() {
@@ -1045,7 +1585,9 @@ class Map {
         _syscall(fstat(file, &stat));
         size_ = stat.st_size;
 
-        data_ = _syscall(mmap(NULL, size_, pflag, mflag, file, 0));
+        // XXX: mmap() rejects empty mappings
+        if (size_ != 0)
+            data_ = _syscall(mmap(NULL, size_, pflag, mflag, file, 0));
     }
 
     void open(const std::string &path, bool edit) {
@@ -1063,12 +1605,246 @@ class Map {
         return size_;
     }
 
+    int file() const {
+        return file_.file();
+    }
+
     operator std::string() const {
         return std::string(static_cast<char *>(data_), size_);
     }
 };
+
+// reads a file through a private mapping, so signing can use the bytes in place instead of copying them
+class MapBuffer :
+    public std::streambuf
+{
+  private:
+    Map map_;
+
+  public:
+    MapBuffer(const std::string &path) :
+        map_(path, false)
+    {
+        auto data(static_cast<char *>(map_.data()));
+        setg(data, data, data + map_.size());
+    }
+
+    const void *data() const {
+        return map_.data();
+    }
+
+    size_t size() const {
+        return map_.size();
+    }
+
+    int file() const {
+        return map_.file();
+    }
+
+    virtual pos_type seekoff(off_type offset, std::ios::seekdir direction, std::ios::openmode mode) {
+        if ((mode & std::ios::in) == 0)
+            return pos_type(off_type(-1));
+
+        char *base;
+        if (direction == std::ios::beg)
+            base = eback();
+        else if (direction == std::ios::cur)
+            base = gptr();
+        else
+            base = egptr();
+
+        if (base + offset < eback() || base + offset > egptr())
+            return pos_type(off_type(-1));
+        setg(eback(), base + offset, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    virtual pos_type seekpos(pos_type position, std::ios::openmode mode) {
+        return seekoff(off_type(position), std::ios::beg, mode);
+    }
+};
+
+// writes a file through a shared mapping that grows as needed, so output is a memcpy() rather than a
+// write() per chunk; the file is cut back to what was written when the writer is destroyed
+class MapWriter :
+    public std::streambuf
+{
+  private:
+    int file_;
+    char *data_;
+    size_t size_;
+    size_t offset_;
+
+    // false once the filesystem would not promise the blocks behind the mapping
+    bool mapped_;
+
+    const MapBuffer *source_;
+
+  public:
+    MapWriter() :
+        file_(-1),
+        data_(NULL),
+        size_(0),
+        offset_(0),
+        mapped_(true),
+        source_(NULL)
+    {
+    }
+
+    ~MapWriter() {
+        if (file_ == -1)
+            return;
+        // XXX: nothing can be thrown from here; shrinking a file we hold open is not expected to fail
+        if (data_ != NULL)
+            munmap(data_, size_);
+        ftruncate(file_, offset_);
+        close(file_);
+    }
+
+    bool open(const std::string &path) {
+        _assert(file_ == -1);
+        file_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        return file_ != -1;
+    }
+
+    // only ever a new file: fails if anything is at path already, a symlink included
+    bool create(const std::string &path) {
+        _assert(file_ == -1);
+#ifdef __WIN32__
+        file_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+#else
+        file_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0666);
+#endif
+        return file_ != -1;
+    }
+
+  private:
+    // has the filesystem set aside real blocks up to size, so that storing to the mapping cannot fail
+    bool Allocate(size_t size) {
+#if defined(__APPLE__)
+        fstore_t store = {F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, off_t(size - size_), 0};
+        if (fcntl(file_, F_PREALLOCATE, &store) == -1) {
+            store.fst_flags = F_ALLOCATEALL;
+            if (fcntl(file_, F_PREALLOCATE, &store) == -1)
+                return false;
+        }
+        _syscall(ftruncate(file_, size));
+        return true;
+#else
+        return posix_fallocate(file_, 0, size) == 0;
+#endif
+    }
+
+    void Resize(size_t size) {
+        if (mapped_ && !Allocate(size)) {
+            // XXX: a full disk under a mapping is SIGBUS rather than an error, so anything that was not allocated goes through write()
+            if (data_ != NULL)
+                _syscall(munmap(data_, size_));
+            data_ = NULL;
+            mapped_ = false;
+        }
+
+        if (mapped_) {
+            if (data_ != NULL)
+                _syscall(munmap(data_, size_));
+            data_ = static_cast<char *>(_syscall(mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file_, 0)));
+        }
+
+        size_ = size;
+    }
+
+    void Write(size_t offset, const void *data, size_t size) {
+        if (mapped_) {
+            memcpy(data_ + offset, data, size);
+            return;
+        }
+
+        for (size_t done(0); done != size; )
+            done += _syscall(pwrite(file_, static_cast<const char *>(data) + done, size - done, offset + done));
+    }
+
+    // has the kernel put size bytes from offset in file at the end of the output, sharing the
+    // blocks if the filesystem can; returns how many it managed, as it is fine to stop anywhere
+    size_t Copy(int file, off_t offset, size_t size) {
+        size_t done(0);
+#ifdef __linux__
+#ifdef FICLONERANGE
+        // XXX: only whole blocks can be shared, and 4KiB is the common denominator of the filesystems that do it
+        size_t blocks((offset | offset_) % 0x1000 == 0 ? size & ~size_t(0xfff) : 0);
+        if (blocks != 0) {
+            struct file_clone_range range;
+            range.src_fd = file;
+            range.src_offset = offset;
+            range.src_length = blocks;
+            range.dest_offset = offset_;
+            if (ioctl(file_, FICLONERANGE, &range) == 0) {
+                transfers_[ldid::ClonedTransfer] += blocks;
+                done += blocks;
+            }
+        }
+#endif
+
+        loff_t from(offset + done), to(offset_ + done);
+        while (done != size) {
+            auto writ(copy_file_range(file, &from, file_, &to, size - done, 0));
+            if (writ <= 0)
+                break;
+            transfers_[ldid::KernelTransfer] += writ;
+            done += writ;
+        }
+#endif
+        return done;
+    }
+
+  public:
+    // the mapping the unchanged parts of the output are taken from
+    void Source(const MapBuffer *source) {
+        source_ = source;
+    }
+
+  public:
+    // overwrites bytes that were already written, such as a header whose sizes were not known yet
+    void Patch(size_t offset, const void *data, size_t size) {
+        _assert(offset + size <= offset_);
+        Write(offset, data, size);
+    }
+
+    // makes room for at least size more bytes up front
+    void Reserve(size_t size) {
+        if (offset_ + size > size_)
+            Resize(offset_ + size);
+    }
+
+    virtual std::streamsize xsputn(const char_type *data, std::streamsize size) {
+        if (offset_ + size > size_)
+            Resize(std::max<size_t>(offset_ + size, std::max<size_t>(size_ * 2, 0x10000)));
+
+        size_t done(0);
+        if (source_ != NULL && size >= 0x10000) {
+            auto begin(static_cast<const char *>(source_->data()));
+            if (data >= begin && data + size <= begin + source_->size())
+                done = Copy(source_->file(), data - begin, size);
+        }
+
+        Write(offset_ + done, data + done, size - done);
+        transfers_[ldid::MemoryTransfer] += size - done;
+        offset_ += size;
+        return size;
+    }
+
+    virtual int_type overflow(int_type next) {
+        if (!traits_type::eq_int_type(next, traits_type::eof())) {
+            char_type value(traits_type::to_char_type(next));
+            xsputn(&value, 1);
+        }
+
+        return traits_type::not_eof(next);
+    }
+};
 #endif
 
+static void Reserve(std::streambuf &buffer, size_t size);
+
 namespace ldid {
 
 std::string Analyze(const void *data, size_t size) {
@@ -1100,6 +1876,8 @@ std::string Analyze(const void *data, size_t size) {
 }
 
 static void Allocate(const void *idata, size_t isize, std::streambuf &output, const Functor<size_t (const MachHeader &, size_t)> &allocate, const Functor<size_t (const MachHeader &, std::streambuf &output, size_t, const std::string &, const char *, const Functor<void (double)> &)> &save, const Functor<void (double)> &percent) {
+    Timer timer(AllocatePhase);
+
     FatHeader source(const_cast<void *>(idata), isize);
 
     size_t offset(0);
@@ -1169,7 +1947,12 @@ static void Allocate(const void *idata, size_t isize, std::streambuf &output, co
         offset = Align(offset, 0x10);
     }
 
-    size_t position(0);
+    if (!allocations.empty()) {
+        auto &allocation(allocations.back());
+        Reserve(output, allocation.offset_ + allocation.limit_ + allocation.alloc_);
+    }
+
+    size_t position(0);
 
     if (source.IsFat()) {
         fat_header fat_header;
@@ -1192,16 +1975,46 @@ static void Allocate(const void *idata, size_t isize, std::streambuf &output, co
         }
     }
 
+    std::vector<std::string> overlaps;
+
     _foreach (allocation, allocations) {
         auto &mach_header(allocation.mach_header_);
 
-        pad(output, allocation.offset_ - position);
-        position = allocation.offset_;
+        uint32_t count(0);
+        uint32_t after(0);
+
+        _foreach (load_command, mach_header.GetLoadCommands())
+            if (mach_header.Swap(load_command->cmd) != LC_CODE_SIGNATURE) {
+                ++count;
+                after += mach_header.Swap(load_command->cmdsize);
+            }
+
+        if (allocation.alloc_ != 0) {
+            ++count;
+            after += sizeof(linkedit_data_command);
+        }
+
+        uint32_t before(mach_header.Swap(mach_header->sizeofcmds));
+        size_t end(sizeof(struct mach_header) + (mach_header.Bits64() ? sizeof(uint32_t) : 0) + std::max(before, after));
+
+        auto top(reinterpret_cast<char *>(mach_header.GetBase()));
+
+        // the new header and load commands are laid out in place over the rest of their first page, which
+        // is both the overlap that save() rehashes and the start of the slice, written out in one piece
+        std::string overlap(Align(end, 0x1000), '\0');
+        char *cursor(&overlap[0]);
+
+        struct mach_header header(*mach_header);
+        header.ncmds = mach_header.Swap(count);
+        header.sizeofcmds = mach_header.Swap(after);
+        memcpy(cursor, &header, sizeof(header));
+        cursor += sizeof(header);
 
-        std::vector<std::string> commands;
+        if (mach_header.Bits64())
+            cursor += sizeof(uint32_t);
 
         _foreach (load_command, mach_header.GetLoadCommands()) {
-            std::string copy(reinterpret_cast<const char *>(load_command), load_command->cmdsize);
+            uint32_t size(mach_header.Swap(load_command->cmdsize));
 
             switch (mach_header.Swap(load_command->cmd)) {
                 case LC_CODE_SIGNATURE:
@@ -1209,7 +2022,7 @@ static void Allocate(const void *idata, size_t isize, std::streambuf &output, co
                 break;
 
                 case LC_SEGMENT: {
-                    auto segment_command(reinterpret_cast<struct segment_command *>(&copy[0]));
+                    auto segment_command(reinterpret_cast<struct segment_command *>(memcpy(cursor, load_command, size)));
                     if (strncmp(segment_command->segname, "__LINKEDIT", 16) != 0)
                         break;
                     size_t size(mach_header.Swap(allocation.limit_ + allocation.alloc_ - mach_header.Swap(segment_command->fileoff)));
@@ -1218,16 +2031,20 @@ static void Allocate(const void *idata, size_t isize, std::streambuf &output, co
                 } break;
 
                 case LC_SEGMENT_64: {
-                    auto segment_command(reinterpret_cast<struct segment_command_64 *>(&copy[0]));
+                    auto segment_command(reinterpret_cast<struct segment_command_64 *>(memcpy(cursor, load_command, size)));
                     if (strncmp(segment_command->segname, "__LINKEDIT", 16) != 0)
                         break;
                     size_t size(mach_header.Swap(allocation.limit_ + allocation.alloc_ - mach_header.Swap(segment_command->fileoff)));
                     segment_command->filesize = size;
                     segment_command->vmsize = Align(size, 1 << allocation.align_);
                 } break;
+
+                default:
+                    memcpy(cursor, load_command, size);
+                break;
             }
 
-            commands.push_back(copy);
+            cursor += size;
         }
 
         if (allocation.alloc_ != 0) {
@@ -1236,60 +2053,58 @@ static void Allocate(const void *idata, size_t isize, std::streambuf &output, co
             signature.cmdsize = mach_header.Swap(uint32_t(sizeof(signature)));
             signature.dataoff = mach_header.Swap(allocation.limit_);
             signature.datasize = mach_header.Swap(allocation.alloc_);
-            commands.push_back(std::string(reinterpret_cast<const char *>(&signature), sizeof(signature)));
+            memcpy(cursor, &signature, sizeof(signature));
         }
 
-        size_t begin(position);
-
-        uint32_t after(0);
-        _foreach(command, commands)
-            after += command.size();
-
-        std::stringbuf altern;
-
-        struct mach_header header(*mach_header);
-        header.ncmds = mach_header.Swap(uint32_t(commands.size()));
-        header.sizeofcmds = mach_header.Swap(after);
-        put(output, &header, sizeof(header));
-        put(altern, &header, sizeof(header));
-        position += sizeof(header);
-
-        if (mach_header.Bits64()) {
-            auto pad(mach_header.Swap(uint32_t(0)));
-            put(output, &pad, sizeof(pad));
-            put(altern, &pad, sizeof(pad));
-            position += sizeof(pad);
-        }
+        memcpy(&overlap[end], top + end, overlap.size() - end);
+        overlaps.push_back(std::move(overlap));
+    }
 
-        _foreach(command, commands) {
-            put(output, command.data(), command.size());
-            put(altern, command.data(), command.size());
-            position += command.size();
-        }
+    // the slices of a fat binary do not depend on each other, so each is hashed and signed on its own
+    // and the results are written out in order; only the slice on this thread reports progress
+    std::vector<std::string> signatures(allocations.size());
+    std::vector<double> progress(allocations.size(), 0);
+    std::mutex mutex;
+    auto caller(std::this_thread::get_id());
+
+    auto sign([&](size_t index) {
+        auto &allocation(allocations[index]);
+        auto top(reinterpret_cast<char *>(allocation.mach_header_.GetBase()));
+
+        auto report([&](double value) {
+            std::lock_guard<std::mutex> lock(mutex);
+            progress[index] = value;
+            if (std::this_thread::get_id() == caller)
+                percent(std::accumulate(progress.begin(), progress.end(), 0.0) / progress.size());
+        });
+
+        std::stringbuf data;
+        size_t saved(save(allocation.mach_header_, data, allocation.limit_, overlaps[index], top, fun(report)));
+        signatures[index] = data.str();
+        _assert(signatures[index].size() == saved && saved <= allocation.alloc_);
+    });
 
-        uint32_t before(mach_header.Swap(mach_header->sizeofcmds));
-        if (before > after) {
-            pad(output, before - after);
-            pad(altern, before - after);
-            position += before - after;
-        }
+    Parallel(allocations.size(), fun(sign));
 
-        auto top(reinterpret_cast<char *>(mach_header.GetBase()));
+    for (size_t index(0); index != allocations.size(); ++index) {
+        auto &allocation(allocations[index]);
+        auto &overlap(overlaps[index]);
+        auto &signature(signatures[index]);
+        auto top(reinterpret_cast<char *>(allocation.mach_header_.GetBase()));
 
-        std::string overlap(altern.str());
-        overlap.append(top + overlap.size(), Align(overlap.size(), 0x1000) - overlap.size());
+        pad(output, allocation.offset_ - position);
+        position = allocation.offset_;
 
-        put(output, top + (position - begin), allocation.size_ - (position - begin), percent);
-        position = begin + allocation.size_;
+        size_t head(std::min<size_t>(overlap.size(), allocation.size_));
+        put(output, overlap.data(), head);
+        put(output, top + head, allocation.size_ - head, percent);
+        position += allocation.size_;
 
         pad(output, allocation.limit_ - allocation.size_);
         position += allocation.limit_ - allocation.size_;
 
-        size_t saved(save(mach_header, output, allocation.limit_, overlap, top, percent));
-        if (allocation.alloc_ > saved)
-            pad(output, allocation.alloc_ - saved);
-        else
-            _assert(allocation.alloc_ == saved);
+        put(output, signature.data(), signature.size());
+        pad(output, allocation.alloc_ - signature.size());
         position += allocation.alloc_;
     }
 }
@@ -1465,6 +2280,161 @@ class Signature {
         return value_;
     }
 };
+
+static std::string Encode(uint8_t tag, const std::string &value) {
+    std::string data(1, char(tag));
+    size_t size(value.size());
+    if (size < 0x80)
+        data += char(size);
+    else {
+        std::string length;
+        for (; size != 0; size >>= 8)
+            length.insert(0, 1, char(size & 0xff));
+        data += char(0x80 | length.size());
+        data += length;
+    }
+    return data + value;
+}
+
+template <typename Value_, typename Code_>
+static std::string Encode(Value_ *value, Code_ code) {
+    auto size(code(value, NULL));
+    _assert(size > 0);
+    std::string data(size, '\0');
+    auto pointer(reinterpret_cast<unsigned char *>(&data[0]));
+    _assert(code(value, &pointer) == size);
+    return data;
+}
+
+// DER orders a SET OF by the encodings of its members (which is what OpenSSL does as well)
+static std::string Encode(std::vector<std::string> values) {
+    std::sort(values.begin(), values.end(), [](const std::string &lhs, const std::string &rhs) {
+        auto order(memcmp(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size())));
+        return order != 0 ? order < 0 : lhs.size() < rhs.size();
+    });
+
+    std::string data;
+    for (const auto &value : values)
+        data += value;
+    return data;
+}
+
+static const std::string OIDSignedData_("\x06\x09\x2a\x86\x48\x86\xf7\x0d\x01\x07\x02", 11);
+static const std::string OIDData_("\x06\x09\x2a\x86\x48\x86\xf7\x0d\x01\x07\x01", 11);
+static const std::string OIDSHA1_("\x06\x05\x2b\x0e\x03\x02\x1a", 7);
+static const std::string OIDSHA256_("\x06\x09\x60\x86\x48\x01\x65\x03\x04\x02\x01", 11);
+static const std::string OIDRSA_("\x06\x09\x2a\x86\x48\x86\xf7\x0d\x01\x01\x01", 11);
+static const std::string OIDContentType_("\x06\x09\x2a\x86\x48\x86\xf7\x0d\x01\x09\x03", 11);
+static const std::string OIDMessageDigest_("\x06\x09\x2a\x86\x48\x86\xf7\x0d\x01\x09\x04", 11);
+static const std::string OIDSigningTime_("\x06\x09\x2a\x86\x48\x86\xf7\x0d\x01\x09\x05", 11);
+
+// everything in a signature but the signing time, the digest and the RSA signature over those is the
+// same for every binary signed with one identity, so it is encoded once. the result is byte for byte
+// what Signature gets out of CMS_sign(): both digest algorithms, every certificate, and a lone SHA-256
+// SignerInfo (OpenSSL refuses the SHA-1 one, as its certificate is already present)
+class Signer {
+  private:
+    Stuff stuff_;
+    bool rsa_;
+
+    std::string header_;
+    std::string certificates_;
+    std::string identifier_;
+    std::string algorithm_;
+
+  public:
+    Signer(const std::string &key) :
+        stuff_(key),
+        rsa_(EVP_PKEY_base_id(stuff_) == EVP_PKEY_RSA)
+    {
+        header_ = Encode(0x02, std::string(1, '\x01'));
+        header_ += Encode(0x31, Encode(std::vector<std::string>{Encode(0x30, OIDSHA1_), Encode(0x30, OIDSHA256_)}));
+        header_ += Encode(0x30, OIDData_);
+
+        std::vector<std::string> certificates;
+        if (STACK_OF(X509) *chain = stuff_)
+            for (int i(0); i != sk_X509_num(chain); ++i)
+                certificates.push_back(Encode(sk_X509_value(chain, i), &i2d_X509));
+        auto leaf(Encode(static_cast<X509 *>(stuff_), &i2d_X509));
+        if (std::find(certificates.begin(), certificates.end(), leaf) == certificates.end())
+            certificates.push_back(leaf);
+        certificates_ = Encode(0xa0, Encode(certificates));
+
+        X509 *cert(stuff_);
+        identifier_ = Encode(0x02, std::string(1, '\x01'));
+        identifier_ += Encode(0x30, Encode(X509_get_issuer_name(cert), &i2d_X509_NAME) + Encode(X509_get_serialNumber(cert), &i2d_ASN1_INTEGER));
+        identifier_ += Encode(0x30, OIDSHA256_);
+
+        algorithm_ = Encode(0x30, OIDRSA_ + std::string("\x05\x00", 2));
+    }
+
+    operator X509 *() const {
+        return stuff_;
+    }
+
+  private:
+    static std::string Attributes(const uint8_t *digest, time_t now) {
+        struct tm when;
+        _assert(gmtime_r(&now, &when) != NULL);
+        char stamp[32];
+        bool utc(when.tm_year >= 50 && when.tm_year < 150);
+        _assert(strftime(stamp, sizeof(stamp), utc ? "%y%m%d%H%M%SZ" : "%Y%m%d%H%M%SZ", &when) != 0);
+
+        return Encode(std::vector<std::string>{
+            Encode(0x30, OIDContentType_ + Encode(0x31, OIDData_)),
+            Encode(0x30, OIDSigningTime_ + Encode(0x31, Encode(utc ? 0x17 : 0x18, stamp))),
+            Encode(0x30, OIDMessageDigest_ + Encode(0x31, Encode(0x04, std::string(reinterpret_cast<const char *>(digest), LDID_SHA256_DIGEST_LENGTH)))),
+        });
+    }
+
+    std::string Assemble(const std::string &attributes, const std::string &signature) const {
+        auto info(Encode(0x30, identifier_ + Encode(0xa0, attributes) + algorithm_ + Encode(0x04, signature)));
+        return Encode(0x30, OIDSignedData_ + Encode(0xa0, Encode(0x30, header_ + certificates_ + Encode(0x31, info))));
+    }
+
+  public:
+    // the length of what operator () will return: for RSA only the time could change it, and
+    // not before 2050; other keys get a trial signature and room for their DER encoding to grow
+    size_t Size() const {
+        if (!rsa_)
+            return operator ()(std::string()).size() + EVP_PKEY_size(stuff_);
+        uint8_t digest[LDID_SHA256_DIGEST_LENGTH] = {};
+        return Assemble(Attributes(digest, time(NULL)), std::string(EVP_PKEY_size(stuff_), '\0')).size();
+    }
+
+    // a detached signature over data, as a DER ContentInfo
+    std::string operator ()(const std::string &data) const {
+        if (!rsa_) {
+            Signature signature(stuff_, Buffer(data));
+            return std::string(Buffer(signature));
+        }
+
+        uint8_t digest[LDID_SHA256_DIGEST_LENGTH];
+        LDID_SHA256(reinterpret_cast<const uint8_t *>(data.data()), data.size(), digest);
+        auto attributes(Attributes(digest, time(NULL)));
+
+        uint8_t hash[LDID_SHA256_DIGEST_LENGTH];
+        auto sign(Encode(0x31, attributes));
+        LDID_SHA256(reinterpret_cast<const uint8_t *>(sign.data()), sign.size(), hash);
+
+        auto context(EVP_PKEY_CTX_new(stuff_, NULL));
+        _assert(context != NULL);
+        _scope({ EVP_PKEY_CTX_free(context); });
+        _assert(EVP_PKEY_sign_init(context) > 0);
+        _assert(EVP_PKEY_CTX_set_rsa_padding(context, RSA_PKCS1_PADDING) > 0);
+        _assert(EVP_PKEY_CTX_set_signature_md(context, EVP_sha256()) > 0);
+
+        size_t size;
+        _assert(EVP_PKEY_sign(context, NULL, &size, hash, sizeof(hash)) > 0);
+        std::string signature(size, '\0');
+        _assert(EVP_PKEY_sign(context, reinterpret_cast<unsigned char *>(&signature[0]), &size, hash, sizeof(hash)) > 0);
+        signature.resize(size);
+
+        return Assemble(attributes, signature);
+    }
+};
+#else
+class Signer;
 #endif
 
 class NullBuffer :
@@ -1535,12 +2505,32 @@ class HashProxy :
     {
     }
 
+    std::streambuf &buffer() const {
+        return buffer_;
+    }
+
     virtual std::streamsize xsputn(const char_type *data, std::streamsize size) {
         _assert(HashBuffer::xsputn(data, size) == size);
         return buffer_.sputn(data, size);
     }
 };
 
+#ifndef LDID_NOTOOLS
+static MapWriter *Writer(std::streambuf &buffer) {
+    if (auto proxy = dynamic_cast<HashProxy *>(&buffer))
+        return Writer(proxy->buffer());
+    return dynamic_cast<MapWriter *>(&buffer);
+}
+#endif
+
+// lets a writer that can preallocate do so once Allocate() has planned its output
+static void Reserve(std::streambuf &buffer, size_t size) {
+#ifndef LDID_NOTOOLS
+    if (auto writer = Writer(buffer))
+        writer->Reserve(size);
+#endif
+}
+
 #ifndef LDID_NOTOOLS
 static bool Starts(const std::string &lhs, const std::string &rhs) {
     return lhs.size() >= rhs.size() && lhs.compare(0, rhs.size(), rhs) == 0;
@@ -1578,10 +2568,10 @@ static void mkdir_p(const std::string &path) {
     mkdir_p(path.substr(0, slash));
 }
 
-static std::string Temporary(std::filebuf &file, const Split &split) {
+static std::string Temporary(MapWriter &file, const Split &split) {
     std::string temp(split.dir + ".ldid." + split.base);
     mkdir_p(split.dir);
-    _assert_(file.open(temp.c_str(), std::ios::out | std::ios::trunc | std::ios::binary) == &file, "open(): %s", temp.c_str());
+    _assert_(file.open(temp), "open(): %s", temp.c_str());
     return temp;
 }
 
@@ -1600,15 +2590,100 @@ static void Commit(const std::string &path, const std::string &temp) {
 
 namespace ldid {
 
-Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const std::string &key, const Slots &slots, const Functor<void (double)> &percent) {
+// what a folder knows of the code slots in the signature a binary already has (see Folder::Trust)
+struct Prior {
+    // the folder vouched for them, and hash_ is what it remembered of their code directories
+    bool trusted_;
+    // set by Sign: whether every one of them was right, and the hash of their code directories now
+    bool right_;
+    Hash hash_;
+};
+
+// the code directory of this type in the signature a binary already has, if it is whole
+static const struct CodeDirectory *Directory(const MachHeader &mach_header, const Algorithm &algorithm, size_t &length) {
+    _foreach (load_command, mach_header.GetLoadCommands()) {
+        if (mach_header.Swap(load_command->cmd) != LC_CODE_SIGNATURE)
+            continue;
+
+        auto signature(reinterpret_cast<struct linkedit_data_command *>(load_command));
+        size_t offset(mach_header.Swap(signature->dataoff));
+        size_t size(mach_header.Swap(signature->datasize));
+        if (offset > mach_header.GetSize() || size > mach_header.GetSize() - offset || size < sizeof(struct SuperBlob))
+            return NULL;
+
+        auto pointer(reinterpret_cast<const uint8_t *>(mach_header.GetBase()) + offset);
+        auto super(reinterpret_cast<const struct SuperBlob *>(pointer));
+        if (Swap(super->blob.magic) != CSMAGIC_EMBEDDED_SIGNATURE)
+            return NULL;
+
+        size_t count(Swap(super->count));
+        if (count > (size - sizeof(struct SuperBlob)) / sizeof(struct BlobIndex))
+            return NULL;
+
+        for (size_t index(0); index != count; ++index) {
+            auto type(Swap(super->index[index].type));
+            if (type != CSSLOT_CODEDIRECTORY && (type < CSSLOT_ALTERNATE || type >= CSSLOT_ALTERNATE + 5))
+                continue;
+
+            size_t begin(Swap(super->index[index].offset));
+            if (begin > size || size - begin < sizeof(struct Blob) + offsetof(struct CodeDirectory, spare2))
+                continue;
+
+            auto blob(reinterpret_cast<const struct Blob *>(pointer + begin));
+            length = Swap(blob->length);
+            if (Swap(blob->magic) != CSMAGIC_CODEDIRECTORY || length > size - begin || length < sizeof(struct Blob) + offsetof(struct CodeDirectory, spare2))
+                continue;
+
+            auto directory(reinterpret_cast<const struct CodeDirectory *>(blob + 1));
+            if (directory->hashType != algorithm.type_ || directory->hashSize != algorithm.size_ || directory->pageSize != PageShift_)
+                continue;
+
+            size_t hashes(Swap(directory->hashOffset));
+            if (hashes > length || (length - hashes) / algorithm.size_ < Swap(directory->nCodeSlots))
+                continue;
+
+            return directory;
+        }
+    }
+
+    return NULL;
+}
+
+// signer is NULL for an ad-hoc signature, and prior NULL if nothing is known about the signature already there
+static Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const Signer *signer, const Slots &slots, Prior *prior, const Functor<void (double)> &percent) {
     Hash hash;
 
+    // the code slots already there are reused only if the folder vouches for having checked every one of them against
+    // the very bytes it still holds, and the code directories holding them are still those it remembered
+    bool trusted(false);
+    std::atomic<bool> right(false);
+
+    if (prior != NULL) {
+        FatHeader source(const_cast<void *>(idata), isize);
+        std::string directories;
+        _foreach (mach_header, source.GetMachHeaders())
+            for (Algorithm *algorithm : GetAlgorithms()) {
+                size_t length;
+                if (auto directory = Directory(mach_header, *algorithm, length))
+                    directories.append(reinterpret_cast<const char *>(directory) - sizeof(struct Blob), length);
+            }
+
+        Hash current;
+        memset(&current, 0, sizeof(current));
+        for (Algorithm *algorithm : GetAlgorithms())
+            (*algorithm)(current, directories.data(), directories.size());
+
+        trusted = prior->trusted_ && memcmp(&prior->hash_, &current, sizeof(current)) == 0;
+        right = !directories.empty();
+        prior->hash_ = current;
+    }
+
     std::string team;
+    size_t certificate(0);
 
 #ifndef LDID_NOSMIME
-    if (!key.empty()) {
-        Stuff stuff(key);
-        auto name(X509_get_subject_name(stuff));
+    if (signer != NULL) {
+        auto name(X509_get_subject_name(*signer));
         _assert(name != NULL);
         auto index(X509_NAME_get_index_by_NID(name, NID_organizationalUnitName, -1));
         _assert(index >= 0);
@@ -1619,11 +2694,13 @@ Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::st
         auto asn(X509_NAME_ENTRY_get_data(entry));
         _assert(asn != NULL);
         team.assign(reinterpret_cast<char *>(ASN1_STRING_data(asn)), ASN1_STRING_length(asn));
+
+        certificate = signer->Size();
     }
 #endif
 
-    // XXX: this is just a "sufficiently large number"
-    size_t certificate(0x3000);
+    // slices are signed concurrently, but the hash returned is still that of the last one
+    auto last(reinterpret_cast<const char *>(FatHeader(const_cast<void *>(idata), isize).GetMachHeaders().back().GetBase()));
 
     Allocate(idata, isize, output, fun([&](const MachHeader &mach_header, size_t size) -> size_t {
         size_t alloc(sizeof(struct SuperBlob));
@@ -1667,13 +2744,14 @@ Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::st
         for (Algorithm *algorithm : GetAlgorithms())
             alloc = Align(alloc + directory + (special + normal) * algorithm->size_, 16);
 
-        if (!key.empty()) {
+        if (certificate != 0) {
             alloc += sizeof(struct BlobIndex);
             alloc += sizeof(struct Blob);
             alloc += certificate;
         }
 
-        return alloc;
+        // the signature is sized exactly now, but the layout stays as 16-byte aligned as it always was
+        return Align(alloc, 16);
     }), fun([&](const MachHeader &mach_header, std::streambuf &output, size_t limit, const std::string &overlap, const char *top, const Functor<void (double)> &percent) -> size_t {
         Blobs blobs;
 
@@ -1706,8 +2784,96 @@ Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::st
             }
         }));
 
+        const auto &algorithms(GetAlgorithms());
+        uint32_t normal((limit + PageSize_ - 1) / PageSize_);
+
+        std::vector<std::vector<uint8_t>> pages;
+        for (Algorithm *algorithm : algorithms)
+            pages.push_back(std::vector<uint8_t>(normal * algorithm->size_));
+
+        // past the new headers, every page is what the old signature hashed if it covered exactly these pages
+        std::vector<const uint8_t *> existing;
+        for (Algorithm *algorithm : algorithms) {
+            size_t length;
+            auto directory(prior == NULL ? NULL : Directory(mach_header, *algorithm, length));
+            if (directory == NULL || Swap(directory->codeLimit) != limit || Swap(directory->nCodeSlots) != normal) {
+                existing.push_back(NULL);
+                right = false;
+            } else
+                existing.push_back(reinterpret_cast<const uint8_t *>(directory) - sizeof(struct Blob) + Swap(directory->hashOffset));
+        }
+
+        auto kept([&](size_t i) {
+            return PageSize_ * i >= overlap.size() || i == normal - 1;
+        });
+
+        // XXX: 64 pages (256KiB) per task keeps the scheduling overhead negligible
+        static const size_t Chunk_(64);
+        // XXX: 8 pages (32KiB) stay in L1 while every algorithm takes its turn at them
+        static const size_t Batch_(8);
+        size_t chunks((normal + Chunk_ - 1) / Chunk_);
+
+        if (true) {
+            Timer timer(HashPhase);
+
+            std::atomic<size_t> done(0);
+            auto caller(std::this_thread::get_id());
+
+            percent(0);
+            Parallel(chunks, fun([&](size_t chunk) {
+                size_t begin(chunk * Chunk_);
+                size_t end(std::min<size_t>(begin + Chunk_, normal));
+
+                for (size_t batch(begin); batch < end; batch += Batch_) {
+                    size_t stop(std::min<size_t>(batch + Batch_, end));
+
+                    for (size_t index(0); index != algorithms.size(); ++index) {
+                        Algorithm &algorithm(*algorithms[index]);
+                        auto *hashes(pages[index].data());
+
+                        if (trusted && existing[index] != NULL) {
+                            for (size_t i(batch); i != stop; ++i)
+                                if (kept(i))
+                                    memcpy(hashes + i * algorithm.size_, existing[index] + i * algorithm.size_, algorithm.size_);
+                                else
+                                    algorithm(hashes + i * algorithm.size_, overlap.data() + PageSize_ * i, PageSize_);
+                            continue;
+                        }
+
+                        // pages covered by the new headers and the final (possibly short) page are hashed one at a time
+                        size_t i(batch);
+                        for (; i != stop && PageSize_ * i < overlap.size() && i != normal - 1; ++i)
+                            algorithm(hashes + i * algorithm.size_, overlap.data() + PageSize_ * i, PageSize_);
+
+                        size_t run(std::min<size_t>(stop, normal - 1));
+                        if (i < run) {
+                            algorithm.Pages(hashes + i * algorithm.size_, top + PageSize_ * i, run - i);
+                            i = run;
+                        }
+
+                        if (i != stop)
+                            algorithm(hashes + i * algorithm.size_, top + PageSize_ * i, ((limit - 1) % PageSize_) + 1);
+
+                        // checked while they are still in cache, so the next signing can vouch for them
+                        if (existing[index] != NULL)
+                            for (size_t i(batch); i != stop; ++i)
+                                if (kept(i) && memcmp(hashes + i * algorithm.size_, existing[index] + i * algorithm.size_, algorithm.size_) != 0)
+                                    right = false;
+                    }
+                }
+
+                done += end - begin;
+                if (std::this_thread::get_id() == caller)
+                    percent(double(done) / normal);
+            }));
+        }
+
+        percent(1);
+
+        Hash local;
+
         unsigned total(0);
-        for (Algorithm *pointer : GetAlgorithms()) {
+        for (Algorithm *pointer : algorithms) {
             Algorithm &algorithm(*pointer);
 
             std::stringbuf data;
@@ -1717,7 +2883,6 @@ Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::st
                 special = std::max(special, blob.first);
             _foreach (slot, posts)
                 special = std::max(special, slot.first);
-            uint32_t normal((limit + PageSize_ - 1) / PageSize_);
 
             CodeDirectory directory;
             directory.version = Swap(uint32_t(0x00020200));
@@ -1769,48 +2934,54 @@ Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::st
             _foreach (slot, posts)
                 memcpy(hashes - slot.first * algorithm.size_, algorithm[slot.second], algorithm.size_);
 
-            percent(0);
-            if (normal != 1)
-                for (size_t i = 0; i != normal - 1; ++i) {
-                    algorithm(hashes + i * algorithm.size_, (PageSize_ * i < overlap.size() ? overlap.data() : top) + PageSize_ * i, PageSize_);
-                    percent(double(i) / normal);
-                }
-            if (normal != 0)
-                algorithm(hashes + (normal - 1) * algorithm.size_, top + PageSize_ * (normal - 1), ((limit - 1) % PageSize_) + 1);
-            percent(1);
+            memcpy(hashes, pages[total].data(), pages[total].size());
 
             put(data, storage.data(), storage.size());
 
             const auto &save(insert(blobs, total == 0 ? CSSLOT_CODEDIRECTORY : CSSLOT_ALTERNATE + total - 1, CSMAGIC_CODEDIRECTORY, data));
-            algorithm(hash, save.data(), save.size());
+            algorithm(local, save.data(), save.size());
 
             ++total;
         }
 
+        if (top == last)
+            hash = local;
+
 #ifndef LDID_NOSMIME
-        if (!key.empty()) {
+        if (signer != NULL) {
             std::stringbuf data;
             const std::string &sign(blobs[CSSLOT_CODEDIRECTORY]);
 
-            Stuff stuff(key);
-            Buffer bio(sign);
+            Timer timer(SignaturePhase);
 
-            Signature signature(stuff, sign);
-            Buffer result(signature);
-            std::string value(result);
+            auto value((*signer)(sign));
             put(data, value.data(), value.size());
 
             const auto &save(insert(blobs, CSSLOT_SIGNATURESLOT, CSMAGIC_BLOBWRAPPER, data));
-            _assert(save.size() <= certificate);
+            _assert(save.size() <= sizeof(struct Blob) + certificate);
         }
 #endif
 
         return put(output, CSMAGIC_EMBEDDED_SIGNATURE, blobs);
     }), percent);
 
+    if (prior != NULL)
+        prior->right_ = right;
+
     return hash;
 }
 
+Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const std::string &key, const Slots &slots, const Functor<void (double)> &percent) {
+#ifndef LDID_NOSMIME
+    if (!key.empty()) {
+        Signer signer(key);
+        return Sign(idata, isize, output, identifier, entitlements, requirement, &signer, slots, NULL, percent);
+    }
+#endif
+
+    return Sign(idata, isize, output, identifier, entitlements, requirement, static_cast<const Signer *>(NULL), slots, NULL, percent);
+}
+
 #ifndef LDID_NOTOOLS
 static void Unsign(void *idata, size_t isize, std::streambuf &output, const Functor<void (double)> &percent) {
     Allocate(idata, isize, output, fun([](const MachHeader &mach_header, size_t size) -> size_t {
@@ -1825,7 +2996,14 @@ std::string DiskFolder::Path(const std::string &path) const {
 }
 
 DiskFolder::DiskFolder(const std::string &path) :
-    path_(path)
+    path_(path),
+    cache_(NULL)
+{
+}
+
+DiskFolder::DiskFolder(const std::string &path, HashCache &cache) :
+    path_(path),
+    cache_(&cache)
 {
 }
 
@@ -1900,15 +3078,21 @@ void DiskFolder::Find(const std::string &root, const std::string &base, const Fu
     }
 }
 
+// nested bundles are signed concurrently (and DiskFolder stays copyable), so commit_ is guarded by one shared lock
+static std::mutex commits_;
+
 void DiskFolder::Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code) {
     if (!edit) {
-        // XXX: use nullbuf
-        std::stringbuf save;
+        NullBuffer save;
         code(save);
     } else {
-        std::filebuf save;
+        MapWriter save;
         auto from(Path(path));
-        commit_[from] = Temporary(save, from);
+        auto temp(Temporary(save, from));
+        {
+            std::lock_guard<std::mutex> lock(commits_);
+            commit_[from] = temp;
+        }
         code(save);
     }
 }
@@ -1918,120 +3102,1316 @@ bool DiskFolder::Look(const std::string &path) const {
 }
 
 void DiskFolder::Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const {
-    std::filebuf data;
-    auto result(data.open(Path(path).c_str(), std::ios::binary | std::ios::in));
-    _assert_(result == &data, "DiskFolder::Open(%s)", path.c_str());
-
-    auto length(data.pubseekoff(0, std::ios::end, std::ios::in));
-    data.pubseekpos(0, std::ios::in);
-    code(data, length, NULL);
+    _assert_(Look(path), "DiskFolder::Open(%s)", path.c_str());
+    MapBuffer data(Path(path));
+    code(data, data.size(), NULL);
 }
 
 void DiskFolder::Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const {
     Find(path, "", code, link);
 }
-#endif
 
-SubFolder::SubFolder(Folder &parent, const std::string &path) :
-    parent_(parent),
-    path_(path)
-{
+static void Stamp(const struct stat &info, int64_t &time, int64_t &nano) {
+#if defined(__APPLE__)
+    time = info.st_mtimespec.tv_sec;
+    nano = info.st_mtimespec.tv_nsec;
+#elif defined(__WIN32__)
+    time = info.st_mtime;
+    nano = 0;
+#else
+    time = info.st_mtim.tv_sec;
+    nano = info.st_mtim.tv_nsec;
+#endif
 }
 
-void SubFolder::Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code) {
-    return parent_.Save(path_ + path, edit, flag, code);
+// no path has a NUL in it, so what is vouched for never meets what is remembered
+static std::string Vouched(const std::string &path) {
+    return std::string(1, '\0') + path;
 }
 
-bool SubFolder::Look(const std::string &path) const {
-    return parent_.Look(path_ + path);
-}
+bool DiskFolder::Recall(const std::string &path, const std::string &name, Hash &hash) const {
+    if (cache_ == NULL)
+        return false;
 
-void SubFolder::Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const {
-    return parent_.Open(path_ + path, code);
-}
+    auto from(Path(path));
+    {
+        std::lock_guard<std::mutex> lock(commits_);
+        if (commit_.find(from) != commit_.end())
+            return false;
+    }
 
-void SubFolder::Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const {
-    return parent_.Find(path_ + path, code, link);
-}
+    struct stat info;
+    if (_syscall(stat(from.c_str(), &info), ENOENT) != 0)
+        return false;
 
-std::string UnionFolder::Map(const std::string &path) const {
-    auto remap(remaps_.find(path));
-    if (remap == remaps_.end())
-        return path;
-    return remap->second;
+    int64_t time, nano;
+    Stamp(info, time, nano);
+    return cache_->Recall(name, info.st_size, time, nano, hash);
 }
 
-void UnionFolder::Map(const std::string &path, const Functor<void (const std::string &)> &code, const std::string &file, const Functor<void (const Functor<void (std::streambuf &, size_t, const void *)> &)> &save) const {
-    if (file.size() >= path.size() && file.substr(0, path.size()) == path)
-        code(file.substr(path.size()));
-}
+// what is on disk stays as it was until we are done: the file is only replaced when a Save of it is committed
+void DiskFolder::Remember(const std::string &path, const std::string &name, const Hash &hash) {
+    if (cache_ == NULL)
+        return;
 
-UnionFolder::UnionFolder(Folder &parent) :
-    parent_(parent)
-{
+    struct stat info;
+    _syscall(stat(Path(path).c_str(), &info));
+
+    int64_t time, nano;
+    Stamp(info, time, nano);
+    cache_->Remember(name, info.st_size, time, nano, hash);
 }
 
-void UnionFolder::Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code) {
-    return parent_.Save(Map(path), edit, flag, code);
+bool DiskFolder::Recall(const std::string &path, Hash &hash) const {
+    return Recall(path, path, hash);
 }
 
-bool UnionFolder::Look(const std::string &path) const {
-    auto file(resets_.find(path));
-    if (file != resets_.end())
-        return true;
-    return parent_.Look(Map(path));
+void DiskFolder::Remember(const std::string &path, const Hash &hash) {
+    Remember(path, path, hash);
 }
 
-void UnionFolder::Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const {
-    auto file(resets_.find(path));
-    if (file == resets_.end())
-        return parent_.Open(Map(path), code);
-    auto &entry(file->second);
+bool DiskFolder::Trust(const std::string &path, Hash &hash) const {
+    return Recall(path, Vouched(path), hash);
+}
 
-    auto &data(*entry.data_);
-    auto length(data.pubseekoff(0, std::ios::end, std::ios::in));
-    data.pubseekpos(0, std::ios::in);
-    code(data, length, entry.flag_);
+void DiskFolder::Vouch(const std::string &path, const Hash &hash) {
+    Remember(path, Vouched(path), hash);
 }
 
-void UnionFolder::Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const {
-    for (auto &reset : resets_)
-        Map(path, code, reset.first, fun([&](const Functor<void (std::streambuf &, size_t, const void *)> &code) {
-            auto &entry(reset.second);
-            auto &data(*entry.data_);
-            auto length(data.pubseekoff(0, std::ios::end, std::ios::in));
-            data.pubseekpos(0, std::ios::in);
-            code(data, length, entry.flag_);
-        }));
+static const char CacheMagic_[8] = {'l', 'd', 'i', 'd', 'h', 'c', '0', '1'};
 
-    for (auto &remap : remaps_)
-        Map(path, code, remap.first, fun([&](const Functor<void (std::streambuf &, size_t, const void *)> &code) {
-            parent_.Open(remap.second, fun([&](std::streambuf &data, size_t length, const void *flag) {
-                code(data, length, flag);
-            }));
-        }));
+HashCache::HashCache(const std::string &path) :
+    path_(path)
+{
+    std::filebuf data;
+    if (data.open(path_.c_str(), std::ios::binary | std::ios::in) == NULL)
+        return;
 
-    parent_.Find(path, fun([&](const std::string &name) {
-        if (deletes_.find(path + name) == deletes_.end())
-            code(name);
-    }), fun([&](const std::string &name, const Functor<std::string ()> &read) {
-        if (deletes_.find(path + name) == deletes_.end())
-            link(name, read);
-    }));
-}
+    // XXX: a cache that cannot be read is treated as empty; it is rewritten when we are done
+    char magic[sizeof(CacheMagic_)];
+    if (most(data, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, CacheMagic_, sizeof(magic)) != 0)
+        return;
 
-#ifndef LDID_NOTOOLS
-static void copy(std::streambuf &source, std::streambuf &target, size_t length, const ldid::Functor<void (double)> &percent) {
-    percent(0);
-    size_t total(0);
+    std::map<std::string, Entry> entries;
     for (;;) {
-        char data[4096 * 4];
-        size_t writ(source.sgetn(data, sizeof(data)));
+        uint32_t length;
+        auto writ(most(data, &length, sizeof(length)));
         if (writ == 0)
             break;
-        _assert(target.sputn(data, writ) == writ);
-        total += writ;
-        percent(double(total) / length);
+        if (writ != sizeof(length) || length > 0x10000)
+            return;
+
+        std::string name(length, '\0');
+        Entry entry;
+        if (most(data, &name[0], length) != length ||
+            most(data, &entry.size_, sizeof(entry.size_)) != sizeof(entry.size_) ||
+            most(data, &entry.time_, sizeof(entry.time_)) != sizeof(entry.time_) ||
+            most(data, &entry.nano_, sizeof(entry.nano_)) != sizeof(entry.nano_) ||
+            most(data, &entry.hash_, sizeof(entry.hash_)) != sizeof(entry.hash_)
+        )
+            return;
+
+        entry.used_ = false;
+        entries[name] = entry;
+    }
+
+    std::swap(entries_, entries);
+}
+
+void HashCache::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // only what this run looked at is kept, so files that disappeared from the bundle age out
+    std::string temp(path_ + ".ldid.tmp");
+    std::filebuf data;
+    if (data.open(temp.c_str(), std::ios::binary | std::ios::out | std::ios::trunc) == NULL)
+        return;
+
+    put(data, CacheMagic_, sizeof(CacheMagic_));
+    for (const auto &entry : entries_) {
+        if (!entry.second.used_)
+            continue;
+        uint32_t length(entry.first.size());
+        put(data, &length, sizeof(length));
+        put(data, entry.first.data(), length);
+        put(data, &entry.second.size_, sizeof(entry.second.size_));
+        put(data, &entry.second.time_, sizeof(entry.second.time_));
+        put(data, &entry.second.nano_, sizeof(entry.second.nano_));
+        put(data, &entry.second.hash_, sizeof(entry.second.hash_));
+    }
+
+    // XXX: the cache is only an optimization, so failing to keep it is not worth failing the signature over
+    if (data.close() == NULL || rename(temp.c_str(), path_.c_str()) != 0)
+        unlink(temp.c_str());
+}
+
+bool HashCache::Recall(const std::string &name, uint64_t size, int64_t time, int64_t nano, Hash &hash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry(entries_.find(name));
+    if (entry == entries_.end())
+        return false;
+    auto &value(entry->second);
+    if (value.size_ != size || value.time_ != time || value.nano_ != nano)
+        return false;
+    value.used_ = true;
+    hash = value.hash_;
+    return true;
+}
+
+void HashCache::Remember(const std::string &name, uint64_t size, int64_t time, int64_t nano, const Hash &hash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto &value(entries_[name]);
+    value.size_ = size;
+    value.time_ = time;
+    value.nano_ = nano;
+    value.hash_ = hash;
+    value.used_ = true;
+}
+
+/* ZIP Archives {{{ */
+static const uint32_t ZipLocal_(0x04034b50);
+static const uint32_t ZipCentral_(0x02014b50);
+static const uint32_t ZipEnd_(0x06054b50);
+static const uint32_t ZipLocator_(0x07064b50);
+static const uint32_t ZipEnd64_(0x06064b50);
+
+// XXX: ZIP is little endian, as is every host this runs on
+template <typename Type_>
+static Type_ Little(const uint8_t *data) {
+    Type_ value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+template <typename Type_>
+static void Little(std::string &data, Type_ value) {
+    data.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// crc32() takes a uInt, which would truncate entries of 4GiB and more
+static uint32_t Crc(uint32_t crc, const uint8_t *data, uint64_t size) {
+    for (uint64_t writ; size != 0; data += writ, size -= writ) {
+        writ = std::min<uint64_t>(size, 1 << 30);
+        crc = crc32(crc, data, writ);
+    }
+    return crc;
+}
+
+// DOS times are local, with two second precision
+static int64_t DosTime(uint16_t time, uint16_t date) {
+    struct tm value = {};
+    value.tm_year = (date >> 9) + 80;
+    value.tm_mon = ((date >> 5) & 0xf) - 1;
+    value.tm_mday = date & 0x1f;
+    value.tm_hour = time >> 11;
+    value.tm_min = (time >> 5) & 0x3f;
+    value.tm_sec = (time & 0x1f) * 2;
+    value.tm_isdst = -1;
+    return mktime(&value);
+}
+
+ZipReader::ZipReader(const std::string &path) :
+    map_(new MapBuffer(path))
+{
+    auto data(static_cast<const uint8_t *>(map_->data()));
+    size_t size(map_->size());
+
+    // the end of central directory record is only followed by a comment of at most 64KiB
+    _assert_(size >= 22, "ZipReader(%s): too short", path.c_str());
+    size_t end(size - 22);
+    while (Little<uint32_t>(data + end) != ZipEnd_) {
+        _assert_(end != 0 && size - end < 22 + 0x10000, "ZipReader(%s): no central directory", path.c_str());
+        --end;
+    }
+
+    uint64_t count(Little<uint16_t>(data + end + 10));
+    uint64_t length(Little<uint32_t>(data + end + 12));
+    uint64_t directory(Little<uint32_t>(data + end + 16));
+
+    if (end >= 20 && Little<uint32_t>(data + end - 20) == ZipLocator_) {
+        uint64_t record(Little<uint64_t>(data + end - 20 + 8));
+        _assert(record + 56 <= size && Little<uint32_t>(data + record) == ZipEnd64_);
+        count = Little<uint64_t>(data + record + 32);
+        length = Little<uint64_t>(data + record + 40);
+        directory = Little<uint64_t>(data + record + 48);
+    }
+
+    _assert(directory + length <= size);
+    const uint8_t *cursor(data + directory);
+    const uint8_t *stop(cursor + length);
+
+    entries_.reserve(count);
+    for (uint64_t index(0); index != count; ++index) {
+        _assert(cursor + 46 <= stop && Little<uint32_t>(cursor) == ZipCentral_);
+
+        uint16_t name(Little<uint16_t>(cursor + 28));
+        uint16_t extra(Little<uint16_t>(cursor + 30));
+        uint16_t comment(Little<uint16_t>(cursor + 32));
+        _assert(cursor + 46 + name + extra + comment <= stop);
+
+        Entry entry;
+        entry.name_.assign(reinterpret_cast<const char *>(cursor + 46), name);
+        entry.method_ = Little<uint16_t>(cursor + 10);
+        entry.crc_ = Little<uint32_t>(cursor + 16);
+        entry.compressed_ = Little<uint32_t>(cursor + 20);
+        entry.size_ = Little<uint32_t>(cursor + 24);
+        entry.offset_ = Little<uint32_t>(cursor + 42);
+
+        // archives made on Unix (3) or OS X (19) keep st_mode in the top of the external attributes
+        uint8_t system(Little<uint16_t>(cursor + 4) >> 8);
+        entry.mode_ = system == 3 || system == 19 ? Little<uint32_t>(cursor + 38) >> 16 : 0;
+        entry.time_ = DosTime(Little<uint16_t>(cursor + 12), Little<uint16_t>(cursor + 14));
+
+        // the ZIP64 extra field holds whichever of these did not fit, in this order
+        for (const uint8_t *field(cursor + 46 + name), *last(field + extra); field + 4 <= last; field += 4 + Little<uint16_t>(field + 2)) {
+            // the extended timestamp has the exact modification time, which is what unzip goes by when it is there
+            if (Little<uint16_t>(field) == 0x5455 && Little<uint16_t>(field + 2) >= 5 && field + 9 <= last && (field[4] & 1) != 0)
+                entry.time_ = int32_t(Little<uint32_t>(field + 5));
+            if (Little<uint16_t>(field) != 0x0001)
+                continue;
+            const uint8_t *value(field + 4);
+            const uint8_t *limit(value + Little<uint16_t>(field + 2));
+            for (uint64_t *large : {&entry.size_, &entry.compressed_, &entry.offset_})
+                if (*large == 0xffffffff) {
+                    _assert(value + 8 <= limit);
+                    *large = Little<uint64_t>(value);
+                    value += 8;
+                }
+        }
+
+        entries_.push_back(entry);
+        cursor += 46 + name + extra + comment;
+    }
+}
+
+ZipReader::~ZipReader() {
+}
+
+const void *ZipReader::Data(const Entry &entry) const {
+    auto data(static_cast<const uint8_t *>(map_->data()));
+    size_t size(map_->size());
+
+    _assert(entry.offset_ + 30 <= size);
+    auto local(data + entry.offset_);
+    _assert(Little<uint32_t>(local) == ZipLocal_);
+
+    uint64_t begin(entry.offset_ + 30 + Little<uint16_t>(local + 26) + Little<uint16_t>(local + 28));
+    _assert(begin + entry.compressed_ <= size);
+    return data + begin;
+}
+
+void ZipReader::Read(const Entry &entry, const Functor<void (const void *, size_t)> &code) const {
+    auto data(static_cast<const uint8_t *>(Data(entry)));
+
+    if (entry.method_ == 0) {
+        _assert(entry.compressed_ == entry.size_);
+        _assert_(Crc(crc32(0, NULL, 0), data, entry.size_) == entry.crc_, "ZipReader::Read(%s): bad CRC", entry.name_.c_str());
+        code(data, entry.size_);
+        return;
+    }
+
+    _assert_(entry.method_ == 8, "ZipReader::Read(%s): method %u", entry.name_.c_str(), entry.method_);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    _assert(inflateInit2(&stream, -MAX_WBITS) == Z_OK);
+    _scope({ inflateEnd(&stream); });
+
+    // XXX: this is on the heap as threads other than the main one only get a 512KiB stack on Darwin
+    std::vector<uint8_t> buffer(0x40000);
+    uint32_t crc(crc32(0, NULL, 0));
+    uint64_t total(0);
+    uint64_t left(entry.compressed_);
+    stream.next_in = const_cast<Bytef *>(data);
+
+    for (;;) {
+        if (stream.avail_in == 0) {
+            stream.avail_in = std::min<uint64_t>(left, 1 << 30);
+            left -= stream.avail_in;
+        }
+
+        stream.next_out = buffer.data();
+        stream.avail_out = buffer.size();
+        int status(inflate(&stream, Z_NO_FLUSH));
+        _assert_(status == Z_OK || status == Z_STREAM_END, "ZipReader::Read(%s): inflate()=%d", entry.name_.c_str(), status);
+
+        size_t writ(buffer.size() - stream.avail_out);
+        crc = Crc(crc, buffer.data(), writ);
+        total += writ;
+        if (writ != 0)
+            code(buffer.data(), writ);
+
+        if (status == Z_STREAM_END)
+            break;
+    }
+
+    _assert_(total == entry.size_ && crc == entry.crc_, "ZipReader::Read(%s): bad CRC", entry.name_.c_str());
+}
+
+#ifndef __WIN32__
+// the access and modification times to give what is extracted from an entry
+static std::array<struct timeval, 2> Times(const ZipEntry &entry) {
+    std::array<struct timeval, 2> times;
+    for (auto &time : times) {
+        time.tv_sec = entry.time_;
+        time.tv_usec = 0;
+    }
+    return times;
+}
+#endif
+
+void ZipReader::Extract(const std::string &prefix, const std::string &directory, const Functor<bool (const std::string &)> &filter) const {
+    std::vector<std::pair<const Entry *, std::string>> files;
+    std::vector<std::pair<const Entry *, std::string>> links;
+    // std::set keeps every directory after its parents
+    std::set<std::string> folders;
+    std::set<std::string> names;
+
+    for (const auto &entry : entries_) {
+        if (!Starts(entry.name_, prefix) || entry.name_.size() == prefix.size())
+            continue;
+        auto path(entry.name_.substr(prefix.size()));
+        _assert_(path[0] != '/' && path != ".." && !Starts(path, "../") && path.find("/../") == std::string::npos && (path.size() < 3 || path.compare(path.size() - 3, 3, "/..") != 0), "ZipReader::Extract(%s): outside of the archive", entry.name_.c_str());
+
+        if (!filter(path))
+            continue;
+
+        for (size_t slash(path.find('/')); slash != std::string::npos; slash = path.find('/', slash + 1))
+            folders.insert(path.substr(0, slash));
+        if (path[path.size() - 1] == '/')
+            continue;
+
+        // a second entry by the same name could be a symlink the other one is then written through
+        _assert_(names.insert(path).second, "ZipReader::Extract(%s): more than one entry by that name", entry.name_.c_str());
+#ifndef __WIN32__
+        if (S_ISLNK(entry.mode_))
+            links.push_back(std::make_pair(&entry, path));
+        else
+#endif
+            files.push_back(std::make_pair(&entry, path));
+    }
+
+    for (const auto &name : names)
+        _assert_(folders.find(name) == folders.end(), "ZipReader::Extract(%s%s): both a file and a directory", prefix.c_str(), name.c_str());
+
+    mkdir_p(directory);
+    for (const auto &folder : folders) {
+        auto path(directory + "/" + folder);
+#ifdef __WIN32__
+        _syscall(mkdir(path.c_str()), EEXIST);
+#else
+        // whatever was there already has to be a real directory, not a symlink to somewhere else
+        if (_syscall(mkdir(path.c_str(), 0755), EEXIST) == -EEXIST) {
+            struct stat info;
+            _syscall(lstat(path.c_str(), &info));
+            _assert_(S_ISDIR(info.st_mode), "ZipReader::Extract(%s): not a directory", path.c_str());
+        }
+#endif
+    }
+
+    // the largest entries go first, so no core is left inflating a big one on its own at the end
+    std::sort(files.begin(), files.end(), [](const std::pair<const Entry *, std::string> &lhs, const std::pair<const Entry *, std::string> &rhs) {
+        return lhs.first->size_ > rhs.first->size_;
+    });
+
+    auto extract([&](size_t index) {
+        const auto &entry(*files[index].first);
+        auto path(directory + "/" + files[index].second);
+
+        if (true) {
+            MapWriter file;
+            _assert_(file.create(path), "open(): %s", path.c_str());
+            file.Source(map_.get());
+            file.Reserve(entry.size_);
+            Read(entry, fun([&](const void *data, size_t size) {
+                put(file, data, size);
+            }));
+        }
+
+        if ((entry.mode_ & 0777) != 0)
+            _syscall(chmod(path.c_str(), entry.mode_ & 0777));
+#ifndef __WIN32__
+        // only once the file is closed, as trimming it to size counts as a modification
+        _syscall(utimes(path.c_str(), Times(entry).data()));
+#endif
+    });
+
+    Parallel(files.size(), fun(extract));
+
+#ifndef __WIN32__
+    // symlinks only once every file is written, so that none of those writes can go through one
+    for (const auto &link : links) {
+        const auto &entry(*link.first);
+        auto path(directory + "/" + link.second);
+
+        std::string target;
+        Read(entry, fun([&](const void *data, size_t size) {
+            target.append(static_cast<const char *>(data), size);
+        }));
+        _syscall(symlink(target.c_str(), path.c_str()));
+        _syscall(lutimes(path.c_str(), Times(entry).data()));
+    }
+#endif
+}
+
+// these are compressed already, so deflating them again costs time and saves nothing
+static bool Compressed(const std::string &name) {
+    static const char *extensions[] = {"aac", "car", "gif", "gz", "heic", "ipa", "jpeg", "jpg", "m4a", "m4v", "mov", "mp3", "mp4", "png", "webp", "zip"};
+
+    auto dot(name.rfind('.'));
+    if (dot == std::string::npos || name.find('/', dot) != std::string::npos)
+        return false;
+    auto extension(name.substr(dot + 1));
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    for (auto compressed : extensions)
+        if (extension == compressed)
+            return true;
+    return false;
+}
+
+// entries that might not fit in 32 bits once deflated get ZIP64 fields in their local header from the start
+static bool Large(const ZipEntry &entry) {
+    return entry.size_ >= 0xff000000;
+}
+
+// appends time as a DOS time and date, which only go from 1980 to 2107
+static void DosTime(std::string &data, int64_t time) {
+    time_t value(time);
+    struct tm local;
+    if (localtime_r(&value, &local) == NULL || local.tm_year < 80) {
+        Little<uint16_t>(data, 0x0000);
+        Little<uint16_t>(data, 0x0021);
+        return;
+    }
+
+    if (local.tm_year > 207) {
+        Little<uint16_t>(data, 0xbf7d);
+        Little<uint16_t>(data, 0xff9f);
+        return;
+    }
+
+    Little<uint16_t>(data, local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+    Little<uint16_t>(data, (local.tm_year - 80) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday);
+}
+
+static std::string ZipHeader(const ZipEntry &entry) {
+    bool large(Large(entry));
+    _assert(entry.name_.size() <= 0xffff);
+
+    std::string header;
+    Little<uint32_t>(header, ZipLocal_);
+    Little<uint16_t>(header, large ? 45 : 20);
+    // bit 11: the name is UTF-8
+    Little<uint16_t>(header, 0x0800);
+    Little<uint16_t>(header, entry.method_);
+    DosTime(header, entry.time_);
+    Little<uint32_t>(header, entry.crc_);
+    Little<uint32_t>(header, large ? 0xffffffff : entry.compressed_);
+    Little<uint32_t>(header, large ? 0xffffffff : entry.size_);
+    Little<uint16_t>(header, entry.name_.size());
+    Little<uint16_t>(header, large ? 20 : 0);
+    header += entry.name_;
+
+    if (large) {
+        Little<uint16_t>(header, 0x0001);
+        Little<uint16_t>(header, 16);
+        Little<uint64_t>(header, entry.size_);
+        Little<uint64_t>(header, entry.compressed_);
+    }
+
+    return header;
+}
+
+ZipWriter::ZipWriter(const std::string &path, int level) :
+    file_(new MapWriter()),
+    offset_(0),
+    level_(level)
+{
+    _assert_(file_->open(path), "open(): %s", path.c_str());
+}
+
+ZipWriter::~ZipWriter() {
+}
+
+void ZipWriter::Write(const std::string &data) {
+    put(*file_, data.data(), data.size());
+    offset_ += data.size();
+}
+
+void ZipWriter::Add(const std::string &name, const std::string &path) {
+    struct stat info;
+    _syscall(lstat(path.c_str(), &info));
+
+    Source source;
+    source.name_ = name;
+    source.path_ = path;
+    source.size_ = 0;
+    source.mode_ = info.st_mode;
+    source.time_ = info.st_mtime;
+    source.deflate_ = false;
+    source.reader_ = NULL;
+    source.entry_ = NULL;
+
+    if (S_ISDIR(info.st_mode)) {
+        source.name_ += "/";
+        sources_.push_back(source);
+
+        std::vector<std::string> children;
+        DIR *dir(opendir(path.c_str()));
+        _assert(dir != NULL);
+        _scope({ _syscall(closedir(dir)); });
+        while (auto child = readdir(dir))
+            if (strcmp(child->d_name, ".") != 0 && strcmp(child->d_name, "..") != 0)
+                children.push_back(child->d_name);
+
+        // readdir() order depends on the filesystem, and the archive should not
+        std::sort(children.begin(), children.end());
+        for (const auto &child : children)
+            Add(name + "/" + child, path + "/" + child);
+        return;
+    }
+
+#ifndef __WIN32__
+    if (S_ISLNK(info.st_mode)) {
+        source.data_ = readlink(path);
+        source.size_ = source.data_.size();
+        sources_.push_back(source);
+        return;
+    }
+#endif
+
+    _assert_(S_ISREG(info.st_mode), "ZipWriter::Add(%s): st_mode=%x", path.c_str(), info.st_mode);
+    source.size_ = info.st_size;
+    source.deflate_ = level_ != 0 && source.size_ != 0 && !Compressed(name);
+    sources_.push_back(source);
+}
+
+void ZipWriter::Copy(const ZipReader &reader, const ZipEntry &entry) {
+    Source source;
+    source.name_ = entry.name_;
+    source.size_ = entry.size_;
+    source.mode_ = entry.mode_;
+    source.time_ = entry.time_;
+    source.deflate_ = entry.method_ != 0;
+    source.reader_ = &reader;
+    source.entry_ = &entry;
+    sources_.push_back(source);
+}
+
+void ZipWriter::Close() {
+    // XXX: 256KiB pieces keep every core busy on all but the smallest bundles, and each only loses the
+    // few bytes of a flush to being deflated on its own (they still get the previous 32KiB as a dictionary)
+    static const size_t Piece_(0x40000);
+    // XXX: this bounds how much is read ahead and kept around, compressed, before it is written in order
+    static const uint64_t Window_(64 << 20);
+    static const size_t Pieces_(4096);
+    static const size_t Maps_(32);
+
+    struct Piece {
+        size_t source_;
+        uint64_t offset_;
+        size_t size_;
+        // only files of more than one piece are mapped; the rest are read in the worker
+        std::shared_ptr<MapBuffer> map_;
+        uint32_t crc_;
+        // what goes into the archive, unless it is stored straight out of map_
+        std::string data_;
+    };
+
+    size_t next(0);
+    uint64_t offset(0);
+    std::shared_ptr<MapBuffer> map;
+
+    while (next != sources_.size()) {
+        std::vector<Piece> pieces;
+        uint64_t total(0);
+        size_t maps(0);
+
+        while (next != sources_.size() && total < Window_ && pieces.size() < Pieces_ && maps < Maps_) {
+            const auto &source(sources_[next]);
+
+            // copied entries are written straight out of the other archive, so they are one piece that takes no room
+            if (source.entry_ != NULL) {
+                Piece piece;
+                piece.source_ = next;
+                piece.offset_ = 0;
+                piece.size_ = source.size_;
+                piece.crc_ = source.entry_->crc_;
+                pieces.push_back(std::move(piece));
+                ++next;
+                continue;
+            }
+
+            if (offset == 0 && S_ISREG(source.mode_) && source.size_ > Piece_) {
+                map = std::make_shared<MapBuffer>(source.path_);
+                _assert_(map->size() == source.size_, "ZipWriter::Close(%s): changed size", source.path_.c_str());
+                ++maps;
+            }
+
+            // empty entries still get a piece, as that is what writes their header
+            do {
+                Piece piece;
+                piece.source_ = next;
+                piece.offset_ = offset;
+                piece.size_ = std::min<uint64_t>(Piece_, source.size_ - offset);
+                piece.map_ = map;
+                piece.crc_ = 0;
+                offset += piece.size_;
+                total += piece.size_;
+                pieces.push_back(std::move(piece));
+            } while (offset != source.size_ && total < Window_ && pieces.size() < Pieces_);
+
+            if (offset == source.size_) {
+                ++next;
+                offset = 0;
+                map.reset();
+            }
+        }
+
+        auto compress([&](size_t index) {
+            auto &piece(pieces[index]);
+            const auto &source(sources_[piece.source_]);
+            if (source.entry_ != NULL)
+                return;
+
+            std::string input;
+            const uint8_t *data;
+            if (piece.map_ != NULL)
+                data = static_cast<const uint8_t *>(piece.map_->data()) + piece.offset_;
+            else if (S_ISREG(source.mode_)) {
+                input.resize(piece.size_);
+                int file(open(source.path_.c_str(), O_RDONLY));
+                _assert_(file != -1, "open(): %s", source.path_.c_str());
+                _scope({ _syscall(close(file)); });
+                for (size_t done(0); done != input.size(); ) {
+                    auto writ(_syscall(read(file, &input[done], input.size() - done)));
+                    _assert_(writ != 0, "ZipWriter::Close(%s): changed size", source.path_.c_str());
+                    done += writ;
+                }
+                data = reinterpret_cast<const uint8_t *>(input.data());
+            } else
+                data = reinterpret_cast<const uint8_t *>(source.data_.data());
+
+            piece.crc_ = Crc(crc32(0, NULL, 0), data, piece.size_);
+
+            if (!source.deflate_) {
+                if (piece.map_ == NULL)
+                    piece.data_.assign(reinterpret_cast<const char *>(data), piece.size_);
+                return;
+            }
+
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            _assert(deflateInit2(&stream, level_, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+            _scope({ deflateEnd(&stream); });
+
+            if (piece.offset_ != 0) {
+                size_t dictionary(std::min<uint64_t>(piece.offset_, 0x8000));
+                _assert(deflateSetDictionary(&stream, data - dictionary, dictionary) == Z_OK);
+            }
+
+            bool last(piece.offset_ + piece.size_ == source.size_);
+            // the sync flush leaves the stream on a byte boundary, so the next piece can simply follow it
+            piece.data_.resize(deflateBound(&stream, piece.size_) + 16);
+            stream.next_in = const_cast<Bytef *>(data);
+            stream.avail_in = piece.size_;
+            stream.next_out = reinterpret_cast<Bytef *>(&piece.data_[0]);
+            stream.avail_out = piece.data_.size();
+            int status(deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH));
+            _assert_(status == (last ? Z_STREAM_END : Z_OK) && stream.avail_in == 0, "deflate()=%d", status);
+            piece.data_.resize(piece.data_.size() - stream.avail_out);
+        });
+
+        Parallel(pieces.size(), fun(compress));
+
+        size_t size(0);
+        for (const auto &piece : pieces) {
+            const auto &source(sources_[piece.source_]);
+            if (source.entry_ != NULL)
+                size += source.entry_->compressed_;
+            else if (piece.map_ != NULL && !source.deflate_)
+                size += piece.size_;
+            else
+                size += piece.data_.size();
+        }
+        file_->Reserve(size);
+
+        for (const auto &piece : pieces) {
+            const auto &source(sources_[piece.source_]);
+
+            if (source.entry_ != NULL) {
+                ZipEntry entry(*source.entry_);
+                entry.offset_ = offset_;
+                entries_.push_back(entry);
+                Write(ZipHeader(entry));
+
+                file_->Source(source.reader_->map_.get());
+                _scope({ file_->Source(NULL); });
+                put(*file_, source.reader_->Data(*source.entry_), entry.compressed_);
+                offset_ += entry.compressed_;
+                continue;
+            }
+
+            if (piece.offset_ == 0) {
+                ZipEntry entry;
+                entry.name_ = source.name_;
+                entry.method_ = source.deflate_ ? 8 : 0;
+                entry.crc_ = 0;
+                entry.compressed_ = 0;
+                entry.size_ = source.size_;
+                entry.offset_ = offset_;
+                entry.mode_ = source.mode_;
+                entry.time_ = source.time_;
+                entries_.push_back(entry);
+                Write(ZipHeader(entry));
+            }
+
+            auto &entry(entries_.back());
+            entry.crc_ = crc32_combine(entry.crc_, piece.crc_, piece.size_);
+
+            if (piece.map_ != NULL && !source.deflate_) {
+                // stored pieces of a mapped file can be left to the kernel
+                file_->Source(piece.map_.get());
+                _scope({ file_->Source(NULL); });
+                put(*file_, static_cast<const uint8_t *>(piece.map_->data()) + piece.offset_, piece.size_);
+                offset_ += piece.size_;
+                entry.compressed_ += piece.size_;
+            } else {
+                Write(piece.data_);
+                entry.compressed_ += piece.data_.size();
+            }
+
+            if (piece.offset_ + piece.size_ == source.size_) {
+                _assert_(Large(entry) || entry.compressed_ < 0xffffffff, "ZipWriter::Close(%s): too large", entry.name_.c_str());
+                auto header(ZipHeader(entry));
+                file_->Patch(entry.offset_, header.data(), header.size());
+            }
+        }
+    }
+
+    uint64_t directory(offset_);
+    std::string central;
+    for (const auto &entry : entries_) {
+        std::string extra;
+        for (uint64_t large : {entry.size_, entry.compressed_, entry.offset_})
+            if (large >= 0xffffffff)
+                Little<uint64_t>(extra, large);
+        if (!extra.empty()) {
+            std::string field;
+            Little<uint16_t>(field, 0x0001);
+            Little<uint16_t>(field, extra.size());
+            extra = field + extra;
+        }
+
+        uint16_t version(extra.empty() && !Large(entry) ? 20 : 45);
+        Little<uint32_t>(central, ZipCentral_);
+        // made by Unix (3), so the mode in the external attributes is honored
+        Little<uint16_t>(central, 3 << 8 | version);
+        Little<uint16_t>(central, version);
+        Little<uint16_t>(central, 0x0800);
+        Little<uint16_t>(central, entry.method_);
+        DosTime(central, entry.time_);
+        Little<uint32_t>(central, entry.crc_);
+        Little<uint32_t>(central, std::min<uint64_t>(entry.compressed_, 0xffffffff));
+        Little<uint32_t>(central, std::min<uint64_t>(entry.size_, 0xffffffff));
+        Little<uint16_t>(central, entry.name_.size());
+        Little<uint16_t>(central, extra.size());
+        Little<uint16_t>(central, 0);
+        Little<uint16_t>(central, 0);
+        Little<uint16_t>(central, 0);
+        // the low byte is for MS-DOS, which only wants to know about directories
+        Little<uint32_t>(central, entry.mode_ << 16 | (S_ISDIR(entry.mode_) ? 0x10 : 0));
+        Little<uint32_t>(central, std::min<uint64_t>(entry.offset_, 0xffffffff));
+        central += entry.name_;
+        central += extra;
+    }
+    Write(central);
+
+    uint64_t count(entries_.size());
+    uint64_t length(central.size());
+    std::string end;
+
+    if (count >= 0xffff || length >= 0xffffffff || directory >= 0xffffffff) {
+        uint64_t record(offset_);
+        Little<uint32_t>(end, ZipEnd64_);
+        Little<uint64_t>(end, 44);
+        Little<uint16_t>(end, 3 << 8 | 45);
+        Little<uint16_t>(end, 45);
+        Little<uint32_t>(end, 0);
+        Little<uint32_t>(end, 0);
+        Little<uint64_t>(end, count);
+        Little<uint64_t>(end, count);
+        Little<uint64_t>(end, length);
+        Little<uint64_t>(end, directory);
+
+        Little<uint32_t>(end, ZipLocator_);
+        Little<uint32_t>(end, 0);
+        Little<uint64_t>(end, record);
+        Little<uint32_t>(end, 1);
+    }
+
+    Little<uint32_t>(end, ZipEnd_);
+    Little<uint16_t>(end, 0);
+    Little<uint16_t>(end, 0);
+    Little<uint16_t>(end, std::min<uint64_t>(count, 0xffff));
+    Little<uint16_t>(end, std::min<uint64_t>(count, 0xffff));
+    Little<uint32_t>(end, std::min<uint64_t>(length, 0xffffffff));
+    Little<uint32_t>(end, std::min<uint64_t>(directory, 0xffffffff));
+    Little<uint16_t>(end, 0);
+    Write(end);
+
+    sources_.clear();
+    // cutting the file back to what was written happens when the writer lets go of it
+    file_.reset();
+}
+
+// reads an entry of a ZIP archive, inflating it a piece at a time as it is consumed
+class ZipBuffer :
+    public std::streambuf
+{
+  private:
+    const ZipEntry &entry_;
+    z_stream stream_;
+    uint64_t left_;
+    std::vector<char> buffer_;
+    uint32_t crc_;
+    uint64_t total_;
+    bool end_;
+
+  public:
+    ZipBuffer(const ZipReader &reader, const ZipEntry &entry) :
+        entry_(entry),
+        left_(entry.compressed_),
+        crc_(crc32(0, NULL, 0)),
+        total_(0),
+        end_(false)
+    {
+        auto data(static_cast<const char *>(reader.Data(entry)));
+        memset(&stream_, 0, sizeof(stream_));
+
+        // XXX: stored entries are handed out in place, and so their CRC is left unchecked
+        if (entry.method_ == 0) {
+            _assert(entry.compressed_ == entry.size_);
+            setg(const_cast<char *>(data), const_cast<char *>(data), const_cast<char *>(data) + entry.size_);
+            return;
+        }
+
+        _assert_(entry.method_ == 8, "ZipBuffer(%s): method %u", entry.name_.c_str(), entry.method_);
+        _assert(inflateInit2(&stream_, -MAX_WBITS) == Z_OK);
+        stream_.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+        buffer_.resize(0x40000);
+        setg(buffer_.data(), buffer_.data(), buffer_.data());
+    }
+
+    ~ZipBuffer() {
+        if (entry_.method_ != 0)
+            inflateEnd(&stream_);
+    }
+
+    virtual int_type underflow() {
+        if (gptr() != egptr())
+            return traits_type::to_int_type(*gptr());
+        if (entry_.method_ == 0 || end_)
+            return traits_type::eof();
+
+        size_t writ;
+        do {
+            if (stream_.avail_in == 0) {
+                stream_.avail_in = std::min<uint64_t>(left_, 1 << 30);
+                left_ -= stream_.avail_in;
+            }
+
+            stream_.next_out = reinterpret_cast<Bytef *>(buffer_.data());
+            stream_.avail_out = buffer_.size();
+            int status(inflate(&stream_, Z_NO_FLUSH));
+            _assert_(status == Z_OK || status == Z_STREAM_END, "ZipBuffer(%s): inflate()=%d", entry_.name_.c_str(), status);
+
+            writ = buffer_.size() - stream_.avail_out;
+            crc_ = Crc(crc_, reinterpret_cast<const uint8_t *>(buffer_.data()), writ);
+            total_ += writ;
+
+            if (status == Z_STREAM_END) {
+                _assert_(total_ == entry_.size_ && crc_ == entry_.crc_, "ZipBuffer(%s): bad CRC", entry_.name_.c_str());
+                end_ = true;
+                break;
+            }
+        } while (writ == 0);
+
+        _assert_(total_ <= entry_.size_, "ZipBuffer(%s): too long", entry_.name_.c_str());
+        setg(buffer_.data(), buffer_.data(), buffer_.data() + writ);
+        return writ == 0 ? traits_type::eof() : traits_type::to_int_type(*gptr());
+    }
+};
+
+ZipFolder::ZipFolder(const std::string &path, const std::string &prefix, const std::string &output) :
+    reader_(path),
+    prefix_(prefix),
+    output_(output),
+    cache_(NULL),
+    count_(0)
+{
+    for (const auto &entry : reader_.Entries())
+        if (Starts(entry.name_, prefix_) && entry.name_[entry.name_.size() - 1] != '/')
+            entries_[entry.name_.substr(prefix_.size())] = &entry;
+}
+
+ZipFolder::ZipFolder(const std::string &path, const std::string &prefix, const std::string &output, HashCache &cache) :
+    reader_(path),
+    prefix_(prefix),
+    output_(output),
+    cache_(&cache),
+    count_(0)
+{
+    for (const auto &entry : reader_.Entries())
+        if (Starts(entry.name_, prefix_) && entry.name_[entry.name_.size() - 1] != '/')
+            entries_[entry.name_.substr(prefix_.size())] = &entry;
+}
+
+ZipFolder::~ZipFolder() {
+    for (const auto &save : saves_)
+        unlink(save.second.c_str());
+}
+
+void ZipFolder::Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code) {
+    if (!edit) {
+        NullBuffer save;
+        code(save);
+        return;
+    }
+
+    std::string temp;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &save(saves_[path]);
+        if (save.empty())
+            save = output_ + ".ldid." + std::to_string(count_++);
+        temp = save;
+    }
+
+    MapWriter save;
+    _assert_(save.open(temp), "open(): %s", temp.c_str());
+    code(save);
+}
+
+std::string ZipFolder::Saved(const std::string &path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto save(saves_.find(path));
+    return save == saves_.end() ? std::string() : save->second;
+}
+
+// what was saved (such as a new embedded.mobileprovision) is read back as it will be in the new archive
+bool ZipFolder::Look(const std::string &path) const {
+    return entries_.find(path) != entries_.end() || !Saved(path).empty();
+}
+
+void ZipFolder::Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const {
+    auto temp(Saved(path));
+    if (!temp.empty()) {
+        MapBuffer data(temp);
+        code(data, data.size(), NULL);
+        return;
+    }
+
+    auto entry(entries_.find(path));
+    _assert_(entry != entries_.end(), "ZipFolder::Open(%s)", path.c_str());
+    ZipBuffer data(reader_, *entry->second);
+    code(data, entry->second->size_, NULL);
+}
+
+void ZipFolder::Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const {
+    for (const auto &entry : entries_) {
+        if (!Starts(entry.first, path))
+            continue;
+        auto name(entry.first.substr(path.size()));
+
+        if (!S_ISLNK(entry.second->mode_))
+            code(name);
+        else
+            link(name, fun([&]() {
+                std::string target;
+                reader_.Read(*entry.second, fun([&](const void *data, size_t size) {
+                    target.append(static_cast<const char *>(data), size);
+                }));
+                return target;
+            }));
+    }
+
+    std::vector<std::string> saved;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &save : saves_)
+            if (Starts(save.first, path) && entries_.find(save.first) == entries_.end())
+                saved.push_back(save.first);
+    }
+
+    for (const auto &name : saved)
+        code(name.substr(path.size()));
+}
+
+// XXX: a ZIP time only has two second precision, so the entry's CRC takes the place of the nanoseconds in the key
+bool ZipFolder::Recall(const std::string &path, Hash &hash) const {
+    // the entry's key describes what is in the archive, not what was saved over it
+    if (cache_ == NULL || !Saved(path).empty())
+        return false;
+
+    auto entry(entries_.find(path));
+    if (entry == entries_.end())
+        return false;
+    return cache_->Recall(path, entry->second->size_, entry->second->time_, entry->second->crc_, hash);
+}
+
+void ZipFolder::Remember(const std::string &path, const Hash &hash) {
+    if (cache_ == NULL || !Saved(path).empty())
+        return;
+
+    auto entry(entries_.find(path));
+    if (entry != entries_.end())
+        cache_->Remember(path, entry->second->size_, entry->second->time_, entry->second->crc_, hash);
+}
+
+bool ZipFolder::Trust(const std::string &path, Hash &hash) const {
+    if (cache_ == NULL || !Saved(path).empty())
+        return false;
+
+    auto entry(entries_.find(path));
+    if (entry == entries_.end())
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        trusts_.insert(path);
+    }
+
+    return cache_->Recall(Vouched(path), entry->second->size_, entry->second->time_, entry->second->crc_, hash);
+}
+
+// by now the signed file has been saved over the entry, but what was checked was the entry itself
+void ZipFolder::Vouch(const std::string &path, const Hash &hash) {
+    if (cache_ == NULL)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (trusts_.erase(path) == 0)
+            return;
+    }
+
+    auto entry(entries_.find(path));
+    if (entry != entries_.end())
+        cache_->Remember(Vouched(path), entry->second->size_, entry->second->time_, entry->second->crc_, hash);
+}
+
+void ZipFolder::Remove(const std::string &path) {
+    if (path[path.size() - 1] != '/')
+        entries_.erase(path);
+    else
+        for (auto entry(entries_.lower_bound(path)); entry != entries_.end() && Starts(entry->first, path); )
+            entries_.erase(entry++);
+}
+
+void ZipFolder::Close() {
+    ZipWriter writer(output_);
+    std::set<std::string> saved;
+
+    auto add([&](const std::string &path, uint32_t mode) {
+        const auto &temp(saves_.at(path));
+        _syscall(chmod(temp.c_str(), mode));
+        writer.Add(prefix_ + path, temp);
+        saved.insert(path);
+    });
+
+    // the archive keeps its order, and whatever is outside of the bundle (such as SwiftSupport/) comes along
+    for (const auto &entry : reader_.Entries()) {
+        if (!Starts(entry.name_, prefix_) || entry.name_[entry.name_.size() - 1] == '/') {
+            writer.Copy(reader_, entry);
+            continue;
+        }
+
+        auto path(entry.name_.substr(prefix_.size()));
+        if (saves_.find(path) != saves_.end())
+            add(path, (entry.mode_ & 0777) != 0 ? entry.mode_ & 0777 : 0644);
+        else if (entries_.find(path) != entries_.end())
+            writer.Copy(reader_, entry);
+    }
+
+    // files that are new, such as the first _CodeSignature/CodeResources, go at the end
+    for (const auto &save : saves_)
+        if (saved.find(save.first) == saved.end())
+            add(save.first, 0644);
+
+    writer.Close();
+}
+/* }}} */
+#endif
+
+bool Folder::Recall(const std::string &path, Hash &hash) const {
+    return false;
+}
+
+void Folder::Remember(const std::string &path, const Hash &hash) {
+}
+
+bool Folder::Trust(const std::string &path, Hash &hash) const {
+    return false;
+}
+
+void Folder::Vouch(const std::string &path, const Hash &hash) {
+}
+
+void Folder::Finish(const std::string &path, const Hash &hash) {
+}
+
+SubFolder::SubFolder(Folder &parent, const std::string &path) :
+    parent_(parent),
+    path_(path)
+{
+}
+
+void SubFolder::Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code) {
+    return parent_.Save(path_ + path, edit, flag, code);
+}
+
+bool SubFolder::Look(const std::string &path) const {
+    return parent_.Look(path_ + path);
+}
+
+void SubFolder::Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const {
+    return parent_.Open(path_ + path, code);
+}
+
+void SubFolder::Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const {
+    return parent_.Find(path_ + path, code, link);
+}
+
+bool SubFolder::Recall(const std::string &path, Hash &hash) const {
+    return parent_.Recall(path_ + path, hash);
+}
+
+void SubFolder::Remember(const std::string &path, const Hash &hash) {
+    return parent_.Remember(path_ + path, hash);
+}
+
+bool SubFolder::Trust(const std::string &path, Hash &hash) const {
+    return parent_.Trust(path_ + path, hash);
+}
+
+void SubFolder::Vouch(const std::string &path, const Hash &hash) {
+    return parent_.Vouch(path_ + path, hash);
+}
+
+void SubFolder::Finish(const std::string &path, const Hash &hash) {
+    return parent_.Finish(path_ + path, hash);
+}
+
+std::string UnionFolder::Map(const std::string &path) const {
+    auto remap(remaps_.find(path));
+    if (remap == remaps_.end())
+        return path;
+    return remap->second;
+}
+
+void UnionFolder::Map(const std::string &path, const Functor<void (const std::string &)> &code, const std::string &file, const Functor<void (const Functor<void (std::streambuf &, size_t, const void *)> &)> &save) const {
+    if (file.size() >= path.size() && file.substr(0, path.size()) == path)
+        code(file.substr(path.size()));
+}
+
+UnionFolder::UnionFolder(Folder &parent) :
+    parent_(parent)
+{
+}
+
+void UnionFolder::Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code) {
+    return parent_.Save(Map(path), edit, flag, code);
+}
+
+bool UnionFolder::Look(const std::string &path) const {
+    auto file(resets_.find(path));
+    if (file != resets_.end())
+        return true;
+    return parent_.Look(Map(path));
+}
+
+void UnionFolder::Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const {
+    auto file(resets_.find(path));
+    if (file == resets_.end())
+        return parent_.Open(Map(path), code);
+    auto &entry(file->second);
+
+    auto &data(*entry.data_);
+    auto length(data.pubseekoff(0, std::ios::end, std::ios::in));
+    data.pubseekpos(0, std::ios::in);
+    code(data, length, entry.flag_);
+}
+
+void UnionFolder::Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const {
+    for (auto &reset : resets_)
+        Map(path, code, reset.first, fun([&](const Functor<void (std::streambuf &, size_t, const void *)> &code) {
+            auto &entry(reset.second);
+            auto &data(*entry.data_);
+            auto length(data.pubseekoff(0, std::ios::end, std::ios::in));
+            data.pubseekpos(0, std::ios::in);
+            code(data, length, entry.flag_);
+        }));
+
+    for (auto &remap : remaps_)
+        Map(path, code, remap.first, fun([&](const Functor<void (std::streambuf &, size_t, const void *)> &code) {
+            parent_.Open(remap.second, fun([&](std::streambuf &data, size_t length, const void *flag) {
+                code(data, length, flag);
+            }));
+        }));
+
+    parent_.Find(path, fun([&](const std::string &name) {
+        if (deletes_.find(path + name) == deletes_.end())
+            code(name);
+    }), fun([&](const std::string &name, const Functor<std::string ()> &read) {
+        if (deletes_.find(path + name) == deletes_.end())
+            link(name, read);
+    }));
+}
+
+bool UnionFolder::Recall(const std::string &path, Hash &hash) const {
+    if (resets_.find(path) != resets_.end())
+        return false;
+    return parent_.Recall(Map(path), hash);
+}
+
+void UnionFolder::Remember(const std::string &path, const Hash &hash) {
+    if (resets_.find(path) != resets_.end())
+        return;
+    return parent_.Remember(Map(path), hash);
+}
+
+bool UnionFolder::Trust(const std::string &path, Hash &hash) const {
+    if (resets_.find(path) != resets_.end())
+        return false;
+    return parent_.Trust(Map(path), hash);
+}
+
+void UnionFolder::Vouch(const std::string &path, const Hash &hash) {
+    if (resets_.find(path) != resets_.end())
+        return;
+    return parent_.Vouch(Map(path), hash);
+}
+
+void UnionFolder::Finish(const std::string &path, const Hash &hash) {
+    if (resets_.find(path) != resets_.end())
+        return;
+    return parent_.Finish(Map(path), hash);
+}
+
+#ifndef LDID_NOTOOLS
+static void copy(std::streambuf &source, std::streambuf &target, size_t length, const ldid::Functor<void (double)> &percent) {
+    percent(0);
+    size_t total(0);
+    for (;;) {
+        char data[4096 * 4];
+        size_t writ(source.sgetn(data, sizeof(data)));
+        if (writ == 0)
+            break;
+        _assert(target.sputn(data, writ) == writ);
+        total += writ;
+        percent(double(total) / length);
     }
 }
 
@@ -2150,7 +4530,26 @@ struct RuleCode {
 };
 
 #ifndef LDID_NOPLIST
-static Hash Sign(const uint8_t *prefix, size_t size, std::streambuf &buffer, Hash &hash, std::streambuf &save, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const std::string &key, const Slots &slots, size_t length, const Functor<void (double)> &percent) {
+// the stupid hack below hands Sign a few zero bytes past the end of the file; a mapping provides
+// those for free (the rest of its last page reads as zero) unless the file ends exactly on a page
+static const void *Mapped(std::streambuf &buffer, size_t length) {
+    auto mapped(dynamic_cast<MapBuffer *>(&buffer));
+    if (mapped == NULL || mapped->size() != length || length % PageSize_ == 0)
+        return NULL;
+    return mapped->data();
+}
+
+static Hash Sign(const uint8_t *prefix, size_t size, std::streambuf &buffer, Hash &hash, std::streambuf &save, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const Signer *signer, const Slots &slots, Prior *prior, size_t length, const Functor<void (double)> &percent) {
+    if (auto data = Mapped(buffer, length)) {
+        _assert(memcmp(data, prefix, size) == 0);
+        auto writer(Writer(save));
+        if (writer != NULL)
+            writer->Source(dynamic_cast<MapBuffer *>(&buffer));
+        _scope({ if (writer != NULL) writer->Source(NULL); });
+        HashProxy proxy(hash, save);
+        return Sign(data, length + 0x10 - (length & 0xf), proxy, identifier, entitlements, requirement, signer, slots, prior, percent);
+    }
+
     // XXX: this is a miserable fail
     std::stringbuf temp;
     put(temp, prefix, size);
@@ -2160,10 +4559,10 @@ static Hash Sign(const uint8_t *prefix, size_t size, std::streambuf &buffer, Has
     auto data(temp.str());
 
     HashProxy proxy(hash, save);
-    return Sign(data.data(), data.size(), proxy, identifier, entitlements, requirement, key, slots, percent);
+    return Sign(data.data(), data.size(), proxy, identifier, entitlements, requirement, signer, slots, prior, percent);
 }
 
-Bundle Sign(const std::string &root, Folder &folder, const std::string &key, std::map<std::string, Hash> &remote, const std::string &requirement, const Functor<std::string (const std::string &, const std::string &)> &alter, const Functor<void (const std::string &)> &progress, const Functor<void (double)> &percent) {
+static Bundle Sign(const std::string &root, Folder &folder, const Signer *signer, std::map<std::string, Hash> &remote, const std::string &requirement, const Functor<std::string (const std::string &, const std::string &)> &alter, const Functor<void (const std::string &)> &progress, const Functor<void (double)> &percent) {
     std::string executable;
     std::string identifier;
 
@@ -2189,6 +4588,11 @@ Bundle Sign(const std::string &root, Folder &folder, const std::string &key, std
 
     std::string entitlements;
     folder.Open(executable, fun([&](std::streambuf &buffer, size_t length, const void *flag) {
+        if (auto data = Mapped(buffer, length)) {
+            entitlements = alter(root, Analyze(data, length + 0x10 - (length & 0xf)));
+            return;
+        }
+
         // XXX: this is a miserable fail
         std::stringbuf temp;
         copy(buffer, temp, length, percent);
@@ -2240,19 +4644,65 @@ Bundle Sign(const std::string &root, Folder &folder, const std::string &key, std
     Expression nested("^(Frameworks/[^/]*\\.framework|PlugIns/[^/]*\\.appex(()|/[^/]*.app))/(" + failure + ")Info\\.plist$");
     std::map<std::string, Bundle> bundles;
 
+    std::vector<std::pair<std::string, std::string>> nesteds;
+
     folder.Find("", fun([&](const std::string &name) {
         if (!nested(name))
             return;
-        auto bundle(root + Split(name).dir);
+        auto bundle(Split(name).dir);
         bundle.resize(bundle.size() - resources.size());
-        SubFolder subfolder(folder, bundle);
-
-        bundles[nested[1]] = Sign(bundle, subfolder, key, local, "", Starts(name, "PlugIns/") ? alter :
-            static_cast<const Functor<std::string (const std::string &, const std::string &)> &>(fun([&](const std::string &, const std::string &entitlements) -> std::string { return entitlements; }))
-        , progress, percent);
+        nesteds.push_back(std::make_pair(bundle, nested[1]));
     }), fun([&](const std::string &name, const Functor<std::string ()> &read) {
     }));
 
+    // nested bundles and resources are processed concurrently, but the callbacks we were handed
+    // are not expected to be reentrant, so calls from those workers are serialized
+    std::mutex mutex;
+
+    auto serial([&](const std::string &root, const std::string &entitlements) -> std::string {
+        std::lock_guard<std::mutex> lock(mutex);
+        return alter(root, entitlements);
+    });
+
+    auto same([&](const std::string &, const std::string &entitlements) -> std::string {
+        return entitlements;
+    });
+
+    auto report([&](const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        progress(name);
+    });
+
+    auto fraction([&](double value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        percent(value);
+    });
+
+    if (!nesteds.empty()) {
+        // nested bundles only meet again in our CodeResources
+        std::vector<Bundle> signeds(nesteds.size());
+        std::vector<std::map<std::string, Hash>> remotes(nesteds.size());
+
+        Parallel(nesteds.size(), fun([&](size_t index) {
+            const auto &bundle(nesteds[index].first);
+            SubFolder subfolder(folder, bundle);
+
+            signeds[index] = Sign(root + bundle, subfolder, signer, remotes[index], "", Starts(bundle, "PlugIns/") ?
+                static_cast<const Functor<std::string (const std::string &, const std::string &)> &>(fun(serial)) :
+                static_cast<const Functor<std::string (const std::string &, const std::string &)> &>(fun(same))
+            , fun(report), fun(fraction));
+        }));
+
+        // merged in the order Find reported them, so the result never depends on scheduling
+        for (size_t index(0); index != nesteds.size(); ++index) {
+            bundles[nesteds[index].second] = signeds[index];
+            for (const auto &entry : remotes[index]) {
+                _assert(Starts(entry.first, root));
+                local[entry.first.substr(root.size())] = entry.second;
+            }
+        }
+    }
+
     std::set<std::string> excludes;
 
     auto exclude([&](const std::string &name) {
@@ -2271,170 +4721,215 @@ Bundle Sign(const std::string &root, Folder &folder, const std::string &key, std
 
     std::map<std::string, std::string> links;
 
+    std::vector<std::pair<std::string, Hash *>> files;
+
     folder.Find("", fun([&](const std::string &name) {
         if (exclude(name))
             return;
 
         if (local.find(name) != local.end())
             return;
-        auto &hash(local[name]);
+        files.push_back(std::make_pair(name, &local[name]));
+    }), fun([&](const std::string &name, const Functor<std::string ()> &read) {
+        if (exclude(name))
+            return;
 
-        folder.Open(name, fun([&](std::streambuf &data, size_t length, const void *flag) {
-            progress(root + name);
+        links[name] = read();
+    }));
 
-            union {
-                struct {
-                    uint32_t magic;
-                    uint32_t count;
-                };
+    if (true) {
+        Timer timer(ResourcePhase);
 
-                uint8_t bytes[8];
-            } header;
+        // every file already has its own slot in local, so the workers never touch the map itself
+        Parallel(files.size(), fun([&](size_t index) {
+            const auto &name(files[index].first);
+            auto &hash(*files[index].second);
 
-            auto size(most(data, &header.bytes, sizeof(header.bytes)));
+            if (folder.Recall(name, hash)) {
+                report(root + name);
+                folder.Finish(name, hash);
+                return;
+            }
 
-            if (name != "_WatchKitStub/WK" && size == sizeof(header.bytes))
-                switch (Swap(header.magic)) {
-                    case FAT_MAGIC:
-                        // Java class file format
-                        if (Swap(header.count) >= 40)
-                            break;
-                    case FAT_CIGAM:
-                    case MH_MAGIC: case MH_MAGIC_64:
-                    case MH_CIGAM: case MH_CIGAM_64:
-                        folder.Save(name, true, flag, fun([&](std::streambuf &save) {
-                            Slots slots;
-                            Sign(header.bytes, size, data, hash, save, identifier, "", "", key, slots, length, percent);
-                        }));
-                        return;
-                }
+            bool remember(false);
+
+            folder.Open(name, fun([&](std::streambuf &data, size_t length, const void *flag) {
+                report(root + name);
+
+                union {
+                    struct {
+                        uint32_t magic;
+                        uint32_t count;
+                    };
+
+                    uint8_t bytes[8];
+                } header;
+
+                auto size(most(data, &header.bytes, sizeof(header.bytes)));
+
+                if (name != "_WatchKitStub/WK" && size == sizeof(header.bytes))
+                    switch (Swap(header.magic)) {
+                        case FAT_MAGIC:
+                            // Java class file format
+                            if (Swap(header.count) >= 40)
+                                break;
+                        case FAT_CIGAM:
+                        case MH_MAGIC: case MH_MAGIC_64:
+                        case MH_CIGAM: case MH_CIGAM_64:
+                            Prior prior;
+                            prior.trusted_ = folder.Trust(name, prior.hash_);
+                            folder.Save(name, true, flag, fun([&](std::streambuf &save) {
+                                Slots slots;
+                                Sign(header.bytes, size, data, hash, save, identifier, "", "", signer, slots, &prior, length, fun(fraction));
+                            }));
+                            if (prior.right_)
+                                folder.Vouch(name, prior.hash_);
+                            return;
+                    }
 
-            folder.Save(name, false, flag, fun([&](std::streambuf &save) {
-                HashProxy proxy(hash, save);
-                put(proxy, header.bytes, size);
-                copy(data, proxy, length - size, percent);
-            }));
-        }));
-    }), fun([&](const std::string &name, const Functor<std::string ()> &read) {
-        if (exclude(name))
-            return;
+                folder.Save(name, false, flag, fun([&](std::streambuf &save) {
+                    HashProxy proxy(hash, save);
+                    // the header was only read out of the mapping, which still holds the whole file
+                    if (auto mapped = dynamic_cast<MapBuffer *>(&data))
+                        put(proxy, mapped->data(), mapped->size(), fun(fraction));
+                    else {
+                        put(proxy, header.bytes, size);
+                        copy(data, proxy, length - size, fun(fraction));
+                    }
+                }));
 
-        links[name] = read();
-    }));
+                remember = true;
+            }));
 
-    auto plist(plist_new_dict());
-    _scope({ plist_free(plist); });
+            // Mach-O files are signed every time, so only untouched resources are worth remembering
+            if (remember) {
+                folder.Remember(name, hash);
+                folder.Finish(name, hash);
+            }
+        }));
+    }
 
-    for (const auto &version : versions) {
-        auto files(plist_new_dict());
-        plist_dict_set_item(plist, ("files" + version.first).c_str(), files);
+    if (true) {
+        Timer timer(PropertyPhase);
 
-        for (const auto &rule : version.second)
-            rule.Compile();
+        auto plist(plist_new_dict());
+        _scope({ plist_free(plist); });
 
-        bool old(&version.second == &rules1);
+        for (const auto &version : versions) {
+            auto files(plist_new_dict());
+            plist_dict_set_item(plist, ("files" + version.first).c_str(), files);
 
-        for (const auto &hash : local)
             for (const auto &rule : version.second)
-                if (rule(hash.first)) {
-                    if (!old && mac && excludes.find(hash.first) != excludes.end());
-                    else if (old && rule.mode_ == NoMode)
-                        plist_dict_set_item(files, hash.first.c_str(), plist_new_data(reinterpret_cast<const char *>(hash.second.sha1_), sizeof(hash.second.sha1_)));
-                    else if (rule.mode_ != OmitMode) {
-                        auto entry(plist_new_dict());
-                        plist_dict_set_item(entry, "hash", plist_new_data(reinterpret_cast<const char *>(hash.second.sha1_), sizeof(hash.second.sha1_)));
-                        if (!old)
-                            plist_dict_set_item(entry, "hash2", plist_new_data(reinterpret_cast<const char *>(hash.second.sha256_), sizeof(hash.second.sha256_)));
-                        if (rule.mode_ == OptionalMode)
-                            plist_dict_set_item(entry, "optional", plist_new_bool(true));
-                        plist_dict_set_item(files, hash.first.c_str(), entry);
+                rule.Compile();
+
+            bool old(&version.second == &rules1);
+
+            for (const auto &hash : local)
+                for (const auto &rule : version.second)
+                    if (rule(hash.first)) {
+                        if (!old && mac && excludes.find(hash.first) != excludes.end());
+                        else if (old && rule.mode_ == NoMode)
+                            plist_dict_set_item(files, hash.first.c_str(), plist_new_data(reinterpret_cast<const char *>(hash.second.sha1_), sizeof(hash.second.sha1_)));
+                        else if (rule.mode_ != OmitMode) {
+                            auto entry(plist_new_dict());
+                            plist_dict_set_item(entry, "hash", plist_new_data(reinterpret_cast<const char *>(hash.second.sha1_), sizeof(hash.second.sha1_)));
+                            if (!old)
+                                plist_dict_set_item(entry, "hash2", plist_new_data(reinterpret_cast<const char *>(hash.second.sha256_), sizeof(hash.second.sha256_)));
+                            if (rule.mode_ == OptionalMode)
+                                plist_dict_set_item(entry, "optional", plist_new_bool(true));
+                            plist_dict_set_item(files, hash.first.c_str(), entry);
+                        }
+
+                        break;
                     }
 
-                    break;
-                }
+            for (const auto &link : links)
+                for (const auto &rule : version.second)
+                    if (rule(link.first)) {
+                        if (rule.mode_ != OmitMode) {
+                            auto entry(plist_new_dict());
+                            plist_dict_set_item(entry, "symlink", plist_new_string(link.second.c_str()));
+                            if (rule.mode_ == OptionalMode)
+                                plist_dict_set_item(entry, "optional", plist_new_bool(true));
+                            plist_dict_set_item(files, link.first.c_str(), entry);
+                        }
 
-        for (const auto &link : links)
-            for (const auto &rule : version.second)
-                if (rule(link.first)) {
-                    if (rule.mode_ != OmitMode) {
-                        auto entry(plist_new_dict());
-                        plist_dict_set_item(entry, "symlink", plist_new_string(link.second.c_str()));
-                        if (rule.mode_ == OptionalMode)
-                            plist_dict_set_item(entry, "optional", plist_new_bool(true));
-                        plist_dict_set_item(files, link.first.c_str(), entry);
+                        break;
                     }
 
-                    break;
+            if (!old && mac)
+                for (const auto &bundle : bundles) {
+                    auto entry(plist_new_dict());
+                    plist_dict_set_item(entry, "cdhash", plist_new_data(reinterpret_cast<const char *>(bundle.second.hash.sha256_), sizeof(bundle.second.hash.sha256_)));
+                    plist_dict_set_item(entry, "requirement", plist_new_string("anchor apple generic"));
+                    plist_dict_set_item(files, bundle.first.c_str(), entry);
                 }
+        }
 
-        if (!old && mac)
-            for (const auto &bundle : bundles) {
-                auto entry(plist_new_dict());
-                plist_dict_set_item(entry, "cdhash", plist_new_data(reinterpret_cast<const char *>(bundle.second.hash.sha256_), sizeof(bundle.second.hash.sha256_)));
-                plist_dict_set_item(entry, "requirement", plist_new_string("anchor apple generic"));
-                plist_dict_set_item(files, bundle.first.c_str(), entry);
-            }
-    }
+        for (const auto &version : versions) {
+            auto rules(plist_new_dict());
+            plist_dict_set_item(plist, ("rules" + version.first).c_str(), rules);
 
-    for (const auto &version : versions) {
-        auto rules(plist_new_dict());
-        plist_dict_set_item(plist, ("rules" + version.first).c_str(), rules);
+            std::multiset<const Rule *, RuleCode> ordered;
+            for (const auto &rule : version.second)
+                ordered.insert(&rule);
 
-        std::multiset<const Rule *, RuleCode> ordered;
-        for (const auto &rule : version.second)
-            ordered.insert(&rule);
+            for (const auto &rule : ordered)
+                if (rule->weight_ == 1 && rule->mode_ == NoMode)
+                    plist_dict_set_item(rules, rule->code_.c_str(), plist_new_bool(true));
+                else {
+                    auto entry(plist_new_dict());
+                    plist_dict_set_item(rules, rule->code_.c_str(), entry);
 
-        for (const auto &rule : ordered)
-            if (rule->weight_ == 1 && rule->mode_ == NoMode)
-                plist_dict_set_item(rules, rule->code_.c_str(), plist_new_bool(true));
-            else {
-                auto entry(plist_new_dict());
-                plist_dict_set_item(rules, rule->code_.c_str(), entry);
+                    switch (rule->mode_) {
+                        case NoMode:
+                            break;
+                        case OmitMode:
+                            plist_dict_set_item(entry, "omit", plist_new_bool(true));
+                            break;
+                        case OptionalMode:
+                            plist_dict_set_item(entry, "optional", plist_new_bool(true));
+                            break;
+                        case NestedMode:
+                            plist_dict_set_item(entry, "nested", plist_new_bool(true));
+                            break;
+                        case TopMode:
+                            plist_dict_set_item(entry, "top", plist_new_bool(true));
+                            break;
+                    }
 
-                switch (rule->mode_) {
-                    case NoMode:
-                        break;
-                    case OmitMode:
-                        plist_dict_set_item(entry, "omit", plist_new_bool(true));
-                        break;
-                    case OptionalMode:
-                        plist_dict_set_item(entry, "optional", plist_new_bool(true));
-                        break;
-                    case NestedMode:
-                        plist_dict_set_item(entry, "nested", plist_new_bool(true));
-                        break;
-                    case TopMode:
-                        plist_dict_set_item(entry, "top", plist_new_bool(true));
-                        break;
+                    if (rule->weight_ >= 10000)
+                        plist_dict_set_item(entry, "weight", plist_new_uint(rule->weight_));
+                    else if (rule->weight_ != 1)
+                        plist_dict_set_item(entry, "weight", plist_new_real(rule->weight_));
                 }
+        }
 
-                if (rule->weight_ >= 10000)
-                    plist_dict_set_item(entry, "weight", plist_new_uint(rule->weight_));
-                else if (rule->weight_ != 1)
-                    plist_dict_set_item(entry, "weight", plist_new_real(rule->weight_));
-            }
+        folder.Save(signature, true, NULL, fun([&](std::streambuf &save) {
+            HashProxy proxy(local[signature], save);
+            char *xml(NULL);
+            uint32_t size;
+            plist_to_xml(plist, &xml, &size);
+            _scope({ free(xml); });
+            put(proxy, xml, size);
+        }));
     }
 
-    folder.Save(signature, true, NULL, fun([&](std::streambuf &save) {
-        HashProxy proxy(local[signature], save);
-        char *xml(NULL);
-        uint32_t size;
-        plist_to_xml(plist, &xml, &size);
-        _scope({ free(xml); });
-        put(proxy, xml, size);
-    }));
-
     Bundle bundle;
     bundle.path = executable;
 
     folder.Open(executable, fun([&](std::streambuf &buffer, size_t length, const void *flag) {
         progress(root + executable);
+        Prior prior;
+        prior.trusted_ = folder.Trust(executable, prior.hash_);
         folder.Save(executable, true, flag, fun([&](std::streambuf &save) {
             Slots slots;
             slots[1] = local.at(info);
             slots[3] = local.at(signature);
-            bundle.hash = Sign(NULL, 0, buffer, local[executable], save, identifier, entitlements, requirement, key, slots, length, percent);
+            bundle.hash = Sign(NULL, 0, buffer, local[executable], save, identifier, entitlements, requirement, signer, slots, &prior, length, percent);
         }));
+        if (prior.right_)
+            folder.Vouch(executable, prior.hash_);
     }));
 
     for (const auto &entry : local)
@@ -2445,7 +4940,17 @@ Bundle Sign(const std::string &root, Folder &folder, const std::string &key, std
 
 Bundle Sign(const std::string &root, Folder &folder, const std::string &key, const std::string &requirement, const Functor<std::string (const std::string &, const std::string &)> &alter, const Functor<void (const std::string &)> &progress, const Functor<void (double)> &percent) {
     std::map<std::string, Hash> local;
-    return Sign(root, folder, key, local, requirement, alter, progress, percent);
+
+    // parsing the identity (and undoing its PBE) costs far more than signing with it, so it is done once here
+    // and shared by every binary of every nested bundle; nothing of it outlives this call
+#ifndef LDID_NOSMIME
+    if (!key.empty()) {
+        Signer signer(key);
+        return Sign(root, folder, &signer, local, requirement, alter, progress, percent);
+    }
+#endif
+
+    return Sign(root, folder, static_cast<const Signer *>(NULL), local, requirement, alter, progress, percent);
 }
 #endif
 
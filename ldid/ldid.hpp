@@ -3,12 +3,17 @@
 
 #include <cstdlib>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <streambuf>
 #include <string>
 #include <vector>
 
+class MapBuffer;
+class MapWriter;
+
 namespace ldid {
 
 // I wish Apple cared about providing quality toolchains :/
@@ -48,12 +53,28 @@ FunctorImpl<decltype(&Function_::operator())> fun(const Function_ &value) {
     return value;
 }
 
+struct Hash;
+class HashCache;
+
 class Folder {
   public:
     virtual void Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code) = 0;
     virtual bool Look(const std::string &path) const = 0;
     virtual void Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const = 0;
     virtual void Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const = 0;
+
+    // a folder that recalls a hash lets the signer skip both Open and Save(path, false) for that file
+    virtual bool Recall(const std::string &path, Hash &hash) const;
+    virtual void Remember(const std::string &path, const Hash &hash);
+
+    // the same for a Mach-O file whose old code slots were all found right, keyed by the hash of their code directories;
+    // one the folder still trusts lets the signer reuse them, so only the pages under its new headers are hashed again
+    virtual bool Trust(const std::string &path, Hash &hash) const;
+    virtual void Vouch(const std::string &path, const Hash &hash);
+
+    // the signer is done with a file it leaves as it is, which can be used (say, copied elsewhere) before signing is over
+    // XXX: this is called from the signing workers, so it must be safe to call from several threads at once
+    virtual void Finish(const std::string &path, const Hash &hash);
 };
 
 class DiskFolder :
@@ -62,6 +83,7 @@ class DiskFolder :
   private:
     const std::string path_;
     std::map<std::string, std::string> commit_;
+    HashCache *cache_;
 
   protected:
     std::string Path(const std::string &path) const;
@@ -69,14 +91,24 @@ class DiskFolder :
   private:
     void Find(const std::string &root, const std::string &base, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const;
 
+    // the file at path, under name in the cache
+    bool Recall(const std::string &path, const std::string &name, Hash &hash) const;
+    void Remember(const std::string &path, const std::string &name, const Hash &hash);
+
   public:
     DiskFolder(const std::string &path);
+    DiskFolder(const std::string &path, HashCache &cache);
     ~DiskFolder();
 
     virtual void Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code);
     virtual bool Look(const std::string &path) const;
     virtual void Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const;
     virtual void Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const;
+
+    virtual bool Recall(const std::string &path, Hash &hash) const;
+    virtual void Remember(const std::string &path, const Hash &hash);
+    virtual bool Trust(const std::string &path, Hash &hash) const;
+    virtual void Vouch(const std::string &path, const Hash &hash);
 };
 
 class SubFolder :
@@ -93,6 +125,12 @@ class SubFolder :
     virtual bool Look(const std::string &path) const;
     virtual void Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const;
     virtual void Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const;
+
+    virtual bool Recall(const std::string &path, Hash &hash) const;
+    virtual void Remember(const std::string &path, const Hash &hash);
+    virtual bool Trust(const std::string &path, Hash &hash) const;
+    virtual void Vouch(const std::string &path, const Hash &hash);
+    virtual void Finish(const std::string &path, const Hash &hash);
 };
 
 class UnionFolder :
@@ -121,6 +159,12 @@ class UnionFolder :
     virtual void Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const;
     virtual void Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const;
 
+    virtual bool Recall(const std::string &path, Hash &hash) const;
+    virtual void Remember(const std::string &path, const Hash &hash);
+    virtual bool Trust(const std::string &path, Hash &hash) const;
+    virtual void Vouch(const std::string &path, const Hash &hash);
+    virtual void Finish(const std::string &path, const Hash &hash);
+
     void operator ()(const std::string &from) {
         deletes_.insert(from);
     }
@@ -143,6 +187,150 @@ struct Hash {
     uint8_t sha256_[0x20];
 };
 
+// resource hashes kept on disk between runs, keyed by path, size and modification time
+class HashCache {
+  private:
+    struct Entry {
+        uint64_t size_;
+        int64_t time_;
+        int64_t nano_;
+        Hash hash_;
+        bool used_;
+    };
+
+    const std::string path_;
+    std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+
+  public:
+    HashCache(const std::string &path);
+
+    // writes the cache back; it is left as it was if this is never called (say, because signing failed)
+    void Close();
+
+    bool Recall(const std::string &name, uint64_t size, int64_t time, int64_t nano, Hash &hash);
+    void Remember(const std::string &name, uint64_t size, int64_t time, int64_t nano, const Hash &hash);
+};
+
+// what the central directory of a ZIP archive records about each entry
+struct ZipEntry {
+    std::string name_;
+    uint16_t method_;
+    uint32_t crc_;
+    uint64_t compressed_;
+    uint64_t size_;
+    uint64_t offset_;
+    uint32_t mode_;
+    // modification time, in seconds since the epoch
+    int64_t time_;
+};
+
+// a ZIP archive, read in place through a mapping of it
+class ZipReader {
+  public:
+    typedef ZipEntry Entry;
+
+  private:
+    friend class ZipWriter;
+
+    std::unique_ptr<MapBuffer> map_;
+    std::vector<Entry> entries_;
+
+  public:
+    ZipReader(const std::string &path);
+    ~ZipReader();
+
+    const std::vector<Entry> &Entries() const {
+        return entries_;
+    }
+
+    // the bytes of an entry as they are stored in the archive
+    const void *Data(const Entry &entry) const;
+    // the contents of an entry, inflated a piece at a time and checked against its CRC
+    void Read(const Entry &entry, const Functor<void (const void *, size_t)> &code) const;
+    // writes every entry under prefix that filter accepts (given its path less prefix) into directory, many at once
+    void Extract(const std::string &prefix, const std::string &directory, const Functor<bool (const std::string &)> &filter) const;
+};
+
+// writes a ZIP archive, deflating pieces of many entries at once while they still come out in the order added
+class ZipWriter {
+  private:
+    struct Source {
+        std::string name_;
+        std::string path_;
+        std::string data_;
+        uint64_t size_;
+        uint32_t mode_;
+        int64_t time_;
+        bool deflate_;
+        // set for entries copied from another archive as they are
+        const ZipReader *reader_;
+        const ZipEntry *entry_;
+    };
+
+    std::unique_ptr<MapWriter> file_;
+    std::vector<Source> sources_;
+    std::vector<ZipEntry> entries_;
+    uint64_t offset_;
+    int level_;
+
+    void Write(const std::string &data);
+
+  public:
+    // level is zlib's; 0 stores every entry, for readers that would rather not inflate
+    ZipWriter(const std::string &path, int level = -1);
+    ~ZipWriter();
+
+    // queues the file, symlink or directory (and everything in it) at path to be stored as name
+    void Add(const std::string &name, const std::string &path);
+    // queues an entry of another archive, which is copied over without being inflated
+    void Copy(const ZipReader &reader, const ZipEntry &entry);
+    // writes out everything queued, followed by the central directory
+    void Close();
+};
+
+// the bundle at prefix in a ZIP archive; whatever is saved is kept aside until Close() writes a new archive,
+// where everything else is copied from the old one as it was, still compressed
+class ZipFolder :
+    public Folder
+{
+  private:
+    ZipReader reader_;
+    const std::string prefix_;
+    const std::string output_;
+    std::map<std::string, const ZipEntry *> entries_;
+    HashCache *cache_;
+
+    mutable std::mutex mutex_;
+    std::map<std::string, std::string> saves_;
+    size_t count_;
+    // what Trust was asked about before anything was saved over it, which is all Vouch can speak for
+    mutable std::set<std::string> trusts_;
+
+    // where path was saved to, or empty if it has not been
+    std::string Saved(const std::string &path) const;
+
+  public:
+    ZipFolder(const std::string &path, const std::string &prefix, const std::string &output);
+    ZipFolder(const std::string &path, const std::string &prefix, const std::string &output, HashCache &cache);
+    ~ZipFolder();
+
+    virtual void Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code);
+    virtual bool Look(const std::string &path) const;
+    virtual void Open(const std::string &path, const Functor<void (std::streambuf &, size_t, const void *)> &code) const;
+    virtual void Find(const std::string &path, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const;
+
+    virtual bool Recall(const std::string &path, Hash &hash) const;
+    virtual void Remember(const std::string &path, const Hash &hash);
+    virtual bool Trust(const std::string &path, Hash &hash) const;
+    virtual void Vouch(const std::string &path, const Hash &hash);
+
+    // leaves out of the new archive the file at path, or everything under it if path ends in a slash
+    void Remove(const std::string &path);
+    // writes the new archive to output
+    void Close();
+};
+
 struct Bundle {
     std::string path;
     Hash hash;
@@ -154,6 +342,29 @@ typedef std::map<uint32_t, Hash> Slots;
 
 Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const std::string &key, const Slots &slots, const Functor<void (double)> &percent);
 
+enum Phase {
+    AllocatePhase,
+    HashPhase,
+    SignaturePhase,
+    ResourcePhase,
+    PropertyPhase,
+    PhaseCount,
+};
+
+enum Transfer {
+    ClonedTransfer,
+    KernelTransfer,
+    MemoryTransfer,
+    TransferCount,
+};
+
+// seconds spent in each phase since ResetPhases(); a phase is not charged while one nested in it runs on the same thread
+void ResetPhases();
+double GetPhase(Phase phase);
+
+// bytes written to disk since ResetPhases() by sharing the input's blocks, by copy_file_range() and by memcpy()
+uint64_t GetTransfer(Transfer transfer);
+
 }
 
 #endif//LDID_HPP